@@ -0,0 +1,109 @@
+#include "binary_image.h"
+
+#include <algorithm>
+
+#include "common_processors.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+void BinaryImage::allocate(uint32_t height, uint32_t width)
+{
+    this->height = height;
+    this->width = width;
+    words_per_row = (width + 63) / 64;
+    words.assign(words_per_row * height, 0);
+}
+
+void BinaryImage::clear()
+{
+    height = width = 0;
+    words_per_row = 0;
+    words.clear();
+}
+
+// packs `count` <= 64 pixels, `other` gets the pixels that are neither
+// BLACK nor WHITE
+static uint64_t pack_word(const uint8_t* src, uint32_t count, uint64_t& other)
+{
+    uint64_t bits = 0;
+    uint32_t i = 0;
+
+#ifdef __SSE2__
+    const __m128i black = _mm_set1_epi8((char)BLACK);
+    const __m128i white = _mm_set1_epi8((char)WHITE);
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        uint64_t is_black = _mm_movemask_epi8(_mm_cmpeq_epi8(v, black));
+        uint64_t is_white = _mm_movemask_epi8(_mm_cmpeq_epi8(v, white));
+
+        bits |= is_black << i;
+        other |= (~(is_black | is_white) & 0xFFFF) << i;
+    }
+#endif
+
+    for (; i < count; ++i)
+    {
+        bits |= (uint64_t)(src[i] == BLACK) << i;
+        other |= (uint64_t)(src[i] != BLACK && src[i] != WHITE) << i;
+    }
+
+    return bits;
+}
+
+bool BinaryImage::from_image(const ImageData& image)
+{
+    if (image.n_channels != 1)
+    {
+        clear();
+        return false;
+    }
+
+    height = image.height;
+    width = image.width;
+    words_per_row = (width + 63) / 64;
+    words.resize(words_per_row * height);
+
+    uint64_t other = 0;
+    for (uint32_t r = 0; r < height && !other; ++r)
+    {
+        const uint8_t* src = image.row(0, r);
+        uint64_t* dst = row(r);
+
+        for (size_t k = 0; k < words_per_row; ++k)
+        {
+            uint32_t count = std::min<uint32_t>(64, width - k * 64);
+            dst[k] = pack_word(src + k * 64, count, other);
+        }
+    }
+
+    if (other)
+    {
+        clear();
+        return false;
+    }
+
+    return true;
+}
+
+void BinaryImage::to_image(ImageData& image) const
+{
+    image.allocate(1, height, width);
+
+    for (uint32_t r = 0; r < height; ++r)
+    {
+        const uint64_t* src = row(r);
+        uint8_t* dst = image.row(0, r);
+
+        for (size_t k = 0; k < words_per_row; ++k)
+        {
+            uint64_t w = src[k];
+            uint32_t count = std::min<uint32_t>(64, width - k * 64);
+
+            for (uint32_t i = 0; i < count; ++i)
+                dst[k * 64 + i] = w >> i & 1 ? BLACK : WHITE;
+        }
+    }
+}
@@ -0,0 +1,154 @@
+#ifndef BINARY_IMAGE_H
+#define BINARY_IMAGE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "image.h"
+#include "pixel_view.h"
+
+// 1 bit per pixel image for the processing after Duotone, when pixels can
+// only be BLACK or WHITE. A set bit is a BLACK pixel, pixel `x` of a row is
+// bit `x % 64` of word `x / 64`. Rows are padded to whole words, padding
+// bits are always 0
+struct BinaryImage
+{
+    uint32_t height = 0;
+    uint32_t width = 0;
+    size_t words_per_row = 0;
+    std::vector<uint64_t> words;
+
+    // all pixels are WHITE afterwards
+    void allocate(uint32_t height, uint32_t width);
+    void clear();
+
+    // false, leaving this image empty, if `image` isn't a single channel
+    // of only BLACK and WHITE pixels
+    bool from_image(const ImageData& image);
+    void to_image(ImageData& image) const;
+
+    inline uint64_t* row(uint32_t r)
+    {
+        return words.data() + words_per_row * r;
+    }
+
+    inline const uint64_t* row(uint32_t r) const
+    {
+        return words.data() + words_per_row * r;
+    }
+
+    inline bool get(uint32_t x, uint32_t y) const
+    {
+        return row(y)[x / 64] >> (x % 64) & 1;
+    }
+
+    inline void set(uint32_t x, uint32_t y)
+    {
+        row(y)[x / 64] |= 1ull << (x % 64);
+    }
+
+    // pixels of the image in word `k` of any row
+    inline uint64_t valid_bits(size_t k) const
+    {
+        if (k + 1 < words_per_row || width % 64 == 0)
+            return ~0ull;
+        return (1ull << (width % 64)) - 1;
+    }
+
+    // Word `k` of row `r`, either can be outside of the image. Pixels
+    // outside of the image, padding included, read as `outside`
+    inline uint64_t word(int64_t r, int64_t k, bool outside) const
+    {
+        if (r < 0 || r >= height || k < 0 || k >= (int64_t)words_per_row)
+            return outside ? ~0ull : 0;
+
+        uint64_t w = row(r)[k];
+        return outside ? w | ~valid_bits(k) : w;
+    }
+
+    // bit `i` is the left neighbour of pixel `i` of word `k`
+    inline uint64_t west(int64_t r, int64_t k, bool outside) const
+    {
+        return word(r, k, outside) << 1 | word(r, k - 1, outside) >> 63;
+    }
+
+    // bit `i` is the right neighbour of pixel `i` of word `k`
+    inline uint64_t east(int64_t r, int64_t k, bool outside) const
+    {
+        return word(r, k, outside) >> 1 | word(r, k + 1, outside) << 63;
+    }
+};
+
+// Clears the BLACK pixels for which `pick(r, k)` returns set bits, for every
+// word `k` of every row `r`, going from the top row down. Normally `pick`
+// sees the image as it was before any pixel got cleared, rows are written
+// back one behind. With `in_order` every row is written right away, so the
+// rows above are seen as they are after clearing.
+// That's a pass, they're repeated until a pass clears nothing or for
+// `max_passes` passes, passes after the first only revisit the rows next to
+// the changes. The number of passes that cleared something
+template<class Pick>
+size_t clear_picked_repeated(BinaryImage& image, Pick pick, bool in_order,
+    size_t max_passes)
+{
+    size_t n_words = image.words_per_row;
+    std::vector<uint64_t> current(n_words), previous(n_words);
+    DirtyRows dirty(image.height, in_order);
+    size_t passes = 0;
+
+    while (passes < max_passes)
+    {
+        bool processed = false;
+        // `previous` holds the picks of the row above
+        bool pending = false;
+
+        for (uint32_t r = 0; r <= image.height; ++r)
+        {
+            bool picked = false;
+            if (r < image.height && dirty.visit(r))
+                for (size_t k = 0; k < n_words; ++k)
+                {
+                    current[k] = pick(r, k) & image.row(r)[k];
+                    picked = picked || current[k];
+                }
+
+            if (picked)
+            {
+                dirty.changed(r);
+                processed = true;
+            }
+
+            if (in_order)
+            {
+                if (picked)
+                {
+                    uint64_t* row = image.row(r);
+                    for (size_t k = 0; k < n_words; ++k)
+                        row[k] &= ~current[k];
+                }
+                continue;
+            }
+
+            // rows below and above the previous one have been picked already
+            if (pending)
+            {
+                uint64_t* prev_row = image.row(r - 1);
+                for (size_t k = 0; k < n_words; ++k)
+                    prev_row[k] &= ~previous[k];
+            }
+
+            current.swap(previous);
+            pending = picked;
+        }
+
+        dirty.next_pass();
+        if (!processed)
+            break;
+        ++passes;
+    }
+
+    return passes;
+}
+
+#endif // BINARY_IMAGE_H
@@ -0,0 +1,117 @@
+#include "buffer_pool.h"
+
+#include <bit>
+#include <iterator>
+#include <new>
+
+BufferPool::BufferPool(size_t max_cached) : max_cached(max_cached)
+{}
+
+BufferPool::~BufferPool()
+{
+    trim();
+}
+
+BufferPool& BufferPool::global()
+{
+    // never destroyed, images in other static objects may still give their
+    // buffers back after it would have been
+    static BufferPool* pool = new BufferPool(
+        sizeof(size_t) > 4 ? (size_t)2 << 30 : (size_t)256 << 20);
+    return *pool;
+}
+
+size_t BufferPool::size_class(size_t size)
+{
+    if (size <= MIN_POOLED)
+        return size;
+
+    // at most 1/8 of the buffer is wasted
+    size_t step = std::bit_floor(size) / 8;
+    return (size + step - 1) / step * step;
+}
+
+uint8_t* BufferPool::allocate(size_t size)
+{
+    return new (std::align_val_t(ALIGNMENT)) uint8_t[size];
+}
+
+void BufferPool::free(uint8_t* buffer)
+{
+    ::operator delete[](buffer, std::align_val_t(ALIGNMENT));
+}
+
+uint8_t* BufferPool::acquire(size_t size, size_t& capacity)
+{
+    capacity = size_class(size);
+    if (capacity <= MIN_POOLED)
+        return allocate(capacity);
+
+    {
+        std::lock_guard lock(mutex);
+
+        // a somewhat bigger buffer is fine too, an image with fewer channels
+        // than the last one can still have its buffer
+        auto it = free_buffers.lower_bound(capacity);
+        if (it != free_buffers.end() && it->first / 2 <= capacity)
+        {
+            uint8_t* buffer = it->second;
+            capacity = it->first;
+            cached_bytes -= capacity;
+            free_buffers.erase(it);
+            return buffer;
+        }
+    }
+
+    return allocate(capacity);
+}
+
+void BufferPool::release(uint8_t* buffer, size_t capacity)
+{
+    if (!buffer)
+        return;
+
+    if (capacity <= MIN_POOLED || capacity > max_cached)
+    {
+        free(buffer);
+        return;
+    }
+
+    std::lock_guard lock(mutex);
+
+    // the most recently freed buffer is the most likely to be needed again
+    evict(max_cached - capacity);
+    free_buffers.emplace(capacity, buffer);
+    cached_bytes += capacity;
+}
+
+void BufferPool::evict(size_t target)
+{
+    // biggest first, fewer buffers to drop
+    while (cached_bytes > target)
+    {
+        auto it = std::prev(free_buffers.end());
+        cached_bytes -= it->first;
+        free(it->second);
+        free_buffers.erase(it);
+    }
+}
+
+void BufferPool::trim()
+{
+    std::lock_guard lock(mutex);
+    evict(0);
+}
+
+void BufferPool::set_max_cached(size_t max_cached)
+{
+    std::lock_guard lock(mutex);
+    this->max_cached = max_cached;
+    evict(max_cached);
+}
+
+size_t BufferPool::cached() const
+{
+    std::lock_guard lock(mutex);
+    return cached_bytes;
+}
@@ -0,0 +1,54 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+
+// Keeps freed image sized buffers around and hands them out again, so
+// reopening, replaying the history and previewing on a big image don't go
+// back to the allocator and page fault fresh memory on every step.
+// Sizes are rounded up to size classes 1/8 of a power of two apart, small
+// buffers aren't pooled at all. Buffers are 64 byte aligned
+class BufferPool
+{
+public:
+    static constexpr size_t ALIGNMENT = 64;
+    // anything smaller is cheap enough to get from the allocator
+    static constexpr size_t MIN_POOLED = 64 * 1024;
+
+    // `max_cached` bytes of free buffers are kept at most
+    explicit BufferPool(size_t max_cached);
+    ~BufferPool();
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    static BufferPool& global();
+
+    // at least `size` bytes, `capacity` is set to the real size which has
+    // to be passed back to `release`
+    uint8_t* acquire(size_t size, size_t& capacity);
+    void release(uint8_t* buffer, size_t capacity);
+
+    // frees all of the cached buffers
+    void trim();
+    void set_max_cached(size_t);
+
+    size_t cached() const;
+
+private:
+    mutable std::mutex mutex;
+    std::multimap<size_t, uint8_t*> free_buffers;   // by capacity
+    size_t cached_bytes = 0;
+    size_t max_cached;
+
+    static size_t size_class(size_t);
+    static uint8_t* allocate(size_t);
+    static void free(uint8_t*);
+    // with the lock held
+    void evict(size_t target);
+};
+
+#endif // BUFFER_POOL_H
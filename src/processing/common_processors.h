@@ -1,18 +1,39 @@
 #ifndef COMMON_PROCESSORS_H
 #define COMMON_PROCESSORS_H
 
+#include <array>
+#include <cstddef>
+#include <cstdint>
 #include <map>
 #include <unordered_set>
+#include <utility>
+#include <vector>
 
 #include "processor_api.h"
 #include "pixel_view.h"
 
+// pixel count of every 8 bit value
+using Histogram = std::array<uint64_t, 256>;
+
 class Grayscale : public ImageProcessor
 {
 public:
     ~Grayscale() override = default;
 
     bool process(ImageData&) override;
+    bool process(const ImageView&) override;
+
+    // histogram of the last image processed by process(ImageData&), it's
+    // counted while the result is still in cache
+    const Histogram& get_histogram() const;
+
+    // luminance of `width` pixels, `gray` may be the same buffer as `r`.
+    // Also used by the PSD decoder to grayscale rows as they are decoded
+    static void convert_row(const uint8_t* r, const uint8_t* g,
+        const uint8_t* b, uint8_t* gray, size_t width);
+
+private:
+    Histogram histogram = {};
 };
 
 enum Colors
@@ -21,40 +42,92 @@ enum Colors
     WHITE = 255
 };
 
+// Values below the split value become BLACK, the rest WHITE
 class Duotone : public ImageProcessor
 {
 public:
     Duotone();
     ~Duotone() override = default;
 
+    // thresholds in place
     bool process(ImageData&) override;
+    bool process(const ImageView&) override;
 
     void set_split_value(unsigned);
     unsigned get_split_value() const;
 
+    // Builds the histogram of the image, the preview is then drawn through
+    // `get_lut` and split values are judged by the histogram alone, without
+    // touching the pixels until the result is processed
     void init_preview(const ImageData&);
-    const ImageData& get_preview() const;
+    // a histogram that's already known, from Grayscale for example
+    void init_preview(const Histogram&);
+    const Histogram& get_histogram() const;
     void clear_preview();
 
+    // pixels that go BLACK with `split_value`, needs the histogram
+    uint64_t black_count(unsigned split_value) const;
+    // split values picked by Otsu's and by the triangle method
+    unsigned otsu_split() const;
+    unsigned triangle_split() const;
+
+    // the resulting color of every value with the current split value
+    void get_lut(uint8_t lut[256]) const;
+
+    // adds the `n` values to the histogram
+    static void count_values(const uint8_t* values, size_t n, Histogram&);
+    // the whole first channel, in parallel
+    static void count_plane(const ImageData&, Histogram&);
+
 private:
-    unsigned split_value; // [0; 255]
-    ImageData preview;
+    unsigned split_value; // [0; 256], 256 is all BLACK
+    Histogram histogram;
 };
 
-class Fill : public ImageProcessor
+// 3x3 processors that can be run a number of passes in a single call,
+// passes after the first only revisit rows next to the changes
+class RepeatedProcessor : public ImageProcessor
+{
+public:
+    // passes per process() call, 0 repeats until a pass changes nothing
+    inline void set_repeat(size_t passes)
+    {
+        repeat = passes;
+    }
+
+    // passes of the last process() call that changed something
+    inline size_t get_passes() const
+    {
+        return passes;
+    }
+
+protected:
+    size_t repeat = 1;
+    size_t passes = 0;
+
+    inline size_t max_passes() const
+    {
+        return repeat ? repeat : SIZE_MAX;
+    }
+};
+
+class Fill : public RepeatedProcessor
 {
 public:
     Fill();
     ~Fill() override = default;
 
     bool process(ImageData&) override;
+    bool process(const ImageView&) override;
+    // only BLACK and WHITE colors
+    bool process(BinaryImage&) override;
     void set_color(unsigned);
 
 private:
     unsigned color;
 };
 
-class DirectionalPrcessor : public ImageProcessor
+class DirectionalPrcessor : public RepeatedProcessor
 {
 public:
     DirectionalPrcessor() = default;
@@ -79,11 +152,11 @@ public:
     ~ThinLetters() override = default;
 
     bool process(ImageData&) override;
+    bool process(const ImageView&) override;
+    bool process(BinaryImage&) override;
 
 private:
     unsigned color; // "clear" color
-
-    bool process_pixel(const PixelView_3x3&, unsigned, uint8_t&);
 };
 
 class IrregCleanup : public DirectionalPrcessor
@@ -93,11 +166,47 @@ public:
     ~IrregCleanup() override = default;
 
     bool process(ImageData&) override;
+    bool process(const ImageView&) override;
+    bool process(BinaryImage&) override;
+
+    // Cleans up TOP, RIGHT, BOTTOM and LEFT one after the other in a
+    // single sweep instead of the set side. A pass is all four sides
+    inline void set_all_sides(bool all_sides)
+    {
+        this->all_sides = all_sides;
+    }
 
 private:
     unsigned color; // "clear" color
+    bool all_sides;
+
+    bool process_all_sides(BinaryImage&);
+};
 
-    bool process_pixel(const PixelView_3x3&, unsigned, uint8_t&);
+// Thins BLACK shapes down to lines a pixel wide, repeating until nothing
+// changes. Every pass is two subiterations, each decides all the pixels
+// from the image as it was before it, so the result doesn't depend on the
+// order pixels are visited in and rows are processed in parallel.
+// Pixels outside of the image are WHITE
+class Skeletonize : public ImageProcessor
+{
+public:
+    enum Method
+    {
+        ZHANG_SUEN,
+        GUO_HALL
+    };
+
+    Skeletonize();
+    ~Skeletonize() override = default;
+
+    bool process(ImageData&) override;
+    bool process(const ImageView&) override;
+
+    void set_method(Method);
+
+private:
+    Method method;
 };
 
 struct LetterData
@@ -107,7 +216,7 @@ struct LetterData
     Point top_left;
     Point bottom_right;
 
-    std::unordered_set<unsigned> pixels_idxs;
+    std::unordered_set<uint64_t> pixels_idxs;
     LinesMetrics metrics;
     std::multimap<double, char> similarity_values;
 
@@ -138,6 +247,8 @@ public:
     ~LetterFinder() override = default;
 
     bool process(ImageData&) override;
+    // skips straight to the next untraced pixel, finding a letter per call
+    bool process(BinaryImage&) override;
 
     const std::vector<LetterData>& get_letters() const;
     const LetterData& last_letter() const;
@@ -148,7 +259,8 @@ private:
     std::vector<LetterData> letters;
     // This processor processes a single letter at a time,
     // saving its state
-    unsigned idx;
+    uint64_t idx;
+    BinaryImage traced;         // pixels of the found letters, binary only
 };
 
 #endif // COMMON_PROCESSORS_H
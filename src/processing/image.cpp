@@ -0,0 +1,148 @@
+#include "image.h"
+
+#include <cstring>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+void ImageData::PoolRelease::operator()(uint8_t* p) const
+{
+    BufferPool::global().release(p, capacity);
+}
+
+ImageData::ImageData()
+    : n_channels(0), height(0), width(0), stride(0), apron(0), origin(0),
+    buffer()
+{}
+
+ImageData::ImageData(const ImageData& other) : ImageData()
+{
+    *this = other;
+}
+
+ImageData::ImageData(ImageData&& other) noexcept : ImageData()
+{
+    *this = std::move(other);
+}
+
+ImageData& ImageData::operator=(const ImageData& other)
+{
+    if (this == &other)
+        return *this;
+
+    allocate(other.n_channels, other.height, other.width, other.apron);
+    if (other.n_channels)
+        memcpy(buffer.get(), other.buffer.get(),
+            plane_size() * n_channels);
+
+    return *this;
+}
+
+ImageData& ImageData::operator=(ImageData&& other) noexcept
+{
+    n_channels = other.n_channels;
+    height = other.height;
+    width = other.width;
+    stride = other.stride;
+    apron = other.apron;
+    origin = other.origin;
+    buffer = std::move(other.buffer);
+
+    other.n_channels = other.height = other.width = other.apron = 0;
+    other.stride = other.origin = 0;
+
+    return *this;
+}
+
+void ImageData::allocate(uint16_t n_channels, uint32_t height, uint32_t width,
+    uint32_t apron)
+{
+    this->n_channels = n_channels;
+    this->height = height;
+    this->width = width;
+    this->apron = apron;
+
+    // the left part of the apron keeps the rows aligned
+    size_t left = stride_for(apron);
+    stride = stride_for(left + width + apron);
+    origin = stride * apron + left;
+
+    size_t size = plane_size() * n_channels;
+    if (!buffer || size > buffer.get_deleter().capacity)
+    {
+        // the old buffer goes back first, no need to hold on to both
+        buffer.reset();
+        size_t capacity;
+        buffer.reset(BufferPool::global().acquire(size, capacity));
+        buffer.get_deleter().capacity = capacity;
+    }
+
+    // only the padding, the pixels get written by whoever allocated
+    if (!apron && stride != width)
+        for (uint64_t i = 0; i < (uint64_t)n_channels * height; ++i)
+            memset(buffer.get() + i * stride + width, 0, stride - width);
+}
+
+void ImageData::clear()
+{
+    n_channels = height = width = apron = 0;
+    stride = origin = 0;
+    buffer.reset();
+}
+
+void ImageData::set_apron(uint8_t value)
+{
+    if (!apron)
+        return;
+
+    size_t left = stride_for(apron);
+    for (uint16_t ch = 0; ch < n_channels; ++ch)
+    {
+        uint8_t* first = row(ch, 0);
+        memset(first - origin, value, stride * apron);
+        memset(first + stride * height - left, value, stride * apron);
+
+        for (uint32_t r = 0; r < height; ++r)
+        {
+            memset(row(ch, r) - left, value, left);
+            memset(row(ch, r) + width, value, stride - left - width);
+        }
+    }
+}
+
+void ImageData::drop_channels(uint16_t n)
+{
+    if (n >= n_channels)
+        return;
+    n_channels = n;
+
+    // Planes are stored in order, the rest of the buffer is unused now.
+    // Its pages are handed back to the system right away, the buffer keeps
+    // its size and they read as zeros if they get used again
+#ifdef __linux__
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t begin = (uintptr_t)(buffer.get() + plane_size() * n);
+    uintptr_t end = (uintptr_t)(buffer.get() + buffer.get_deleter().capacity);
+    begin = (begin + page - 1) / page * page;
+    end = end / page * page;
+
+    if (end > begin)
+        madvise((void*)begin, end - begin, MADV_DONTNEED);
+#endif
+}
+
+bool ImageData::same_pixels(const ImageData& other) const
+{
+    if (n_channels != other.n_channels || height != other.height ||
+        width != other.width)
+        return false;
+
+    for (uint16_t ch = 0; ch < n_channels; ++ch)
+        for (uint32_t r = 0; r < height; ++r)
+            if (memcmp(row(ch, r), other.row(ch, r), width))
+                return false;
+
+    return true;
+}
@@ -1,22 +1,102 @@
 #ifndef IMAGE
 #define IMAGE
 
+#include <cstddef>
 #include <cstdint>
-#include <vector>
+#include <memory>
 
+#include "buffer_pool.h"
+
+// Planar 8 bit image. All the channels share a single buffer, one plane after
+// another. Every row starts on a 64 byte boundary, rows are `stride` bytes
+// apart and the bytes between `width` and `stride` are zero. Buffers come
+// from and go back to BufferPool::global()
+//
+// Images for the 3x3 processors can have an apron, `apron` extra pixels
+// on every side of every plane, so pixels next to the edges can read their
+// neighbours without bounds checks. The rows still start on a 64 byte
+// boundary, the left part of the apron takes a whole ALIGNMENT. It has to
+// be filled with set_apron(), there's no zeroed padding then
 struct ImageData
 {
+    static constexpr size_t ALIGNMENT = BufferPool::ALIGNMENT;
+
     uint16_t n_channels;        // [1, 24]
-    uint32_t height;            // [1, 30000], also called "rows"
-    uint32_t width;             // [1, 30000], also called "collumns"
-    std::vector<std::vector<uint8_t>> channels_data;
+    uint32_t height;            // [1, 300000], also called "rows"
+    uint32_t width;             // [1, 300000], also called "collumns"
+    size_t stride;              // bytes from one row to the next
+    uint32_t apron;             // pixels around every plane, usually 0
+
+    ImageData();
+    ImageData(const ImageData&);
+    ImageData(ImageData&&) noexcept;
+    ImageData& operator=(const ImageData&);
+    ImageData& operator=(ImageData&&) noexcept;
+
+    // sets the size, reusing the buffer if it's big enough.
+    // Pixel values are left undefined, padding is cleared
+    void allocate(uint16_t n_channels, uint32_t height, uint32_t width,
+        uint32_t apron = 0);
+    void clear();
+
+    // sets the apron of every channel to `value`
+    void set_apron(uint8_t value);
+
+    // keeps the first `n` channels, the memory of the others is released
+    // where the system allows it
+    void drop_channels(uint16_t n);
+
+    // same size and pixels, padding isn't compared
+    bool same_pixels(const ImageData&) const;
 
-    void clear()
+    // the apron rows are `stride` bytes before the first row and after
+    // the last one
+    inline uint8_t* row(uint16_t channel, uint32_t r)
     {
-        n_channels = height = width = 0;
-        channels_data.clear();
+        return buffer.get() + plane_size() * channel + origin + stride * r;
     }
-    // Could implement iterators over rows/collumns, for convenience
+
+    inline const uint8_t* row(uint16_t channel, uint32_t r) const
+    {
+        return buffer.get() + plane_size() * channel + origin + stride * r;
+    }
+
+    // A plane is `plane_size` bytes long, padding included. With an apron
+    // the plane starts before its first pixel, it isn't contiguous then
+    inline uint8_t* plane(uint16_t channel)
+    {
+        return row(channel, 0);
+    }
+
+    inline const uint8_t* plane(uint16_t channel) const
+    {
+        return row(channel, 0);
+    }
+
+    inline size_t plane_size() const
+    {
+        return stride * (height + 2 * (size_t)apron);
+    }
+
+    inline static size_t stride_for(uint32_t width)
+    {
+        return (width + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    }
+
+private:
+    size_t origin;              // bytes from a plane's start to its first pixel
+
+    // hands the buffer back to the BufferPool
+    struct PoolRelease
+    {
+        size_t capacity;
+
+        PoolRelease() : capacity(0)
+        {}
+        void operator()(uint8_t*) const;
+    };
+
+    std::unique_ptr<uint8_t[], PoolRelease> buffer;
 };
 
 #endif
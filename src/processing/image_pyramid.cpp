@@ -0,0 +1,72 @@
+#include "image_pyramid.h"
+
+#include <algorithm>
+
+#include "thread_pool.h"
+
+// rows of the halved image per task
+static constexpr size_t PYRAMID_GRAIN = 64;
+
+// every pixel is the rounded average of 2x2 pixels of `src`, the last row
+// and column are repeated when the size is odd
+static void halve(const ImageData& src, ImageData& dst)
+{
+    dst.allocate(src.n_channels, (src.height + 1) / 2, (src.width + 1) / 2);
+
+    ThreadPool::global().parallel_for(0, (size_t)dst.n_channels * dst.height,
+        PYRAMID_GRAIN, [&](size_t from, size_t to)
+        {
+            for (size_t i = from; i < to; ++i)
+            {
+                uint16_t ch = i / dst.height;
+                uint32_t r = i % dst.height;
+
+                const uint8_t* top = src.row(ch, 2 * r);
+                const uint8_t* bottom = src.row(ch,
+                    std::min(2 * r + 1, src.height - 1));
+                uint8_t* out = dst.row(ch, r);
+
+                uint32_t c = 0;
+                for (; 2 * c + 1 < src.width; ++c)
+                    out[c] = (top[2 * c] + top[2 * c + 1] + bottom[2 * c] +
+                        bottom[2 * c + 1] + 2) >> 2;
+                if (c < dst.width)
+                    out[c] = (top[2 * c] + bottom[2 * c] + 1) >> 1;
+            }
+        });
+}
+
+void ImagePyramid::build(const ImageData& image)
+{
+    base = &image;
+
+    size_t n = 0;
+    uint32_t width = image.width;
+    uint32_t height = image.height;
+    while (std::max(width, height) > MIN_SIZE)
+    {
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+        ++n;
+    }
+
+    // buffers of a previous image get reused
+    levels.resize(n);
+    for (size_t i = 0; i < n; ++i)
+        halve(level(i), levels[i]);
+}
+
+void ImagePyramid::clear()
+{
+    base = nullptr;
+    levels.clear();
+}
+
+size_t ImagePyramid::level_for(double scale) const
+{
+    size_t i = 0;
+    while (i + 1 < n_levels() && scale * (2 << i) <= 1)
+        ++i;
+
+    return i;
+}
@@ -0,0 +1,49 @@
+#ifndef IMAGE_PYRAMID_H
+#define IMAGE_PYRAMID_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "image.h"
+
+// Copies of an image halved over and over, for drawing it zoomed out
+// without going over every pixel. Level 0 is the image itself, it isn't
+// copied, so the image has to outlive the pyramid and the pyramid has to
+// be rebuilt whenever the image changes
+class ImagePyramid
+{
+public:
+    // no level gets smaller than this on its longer side
+    static constexpr uint32_t MIN_SIZE = 256;
+
+    void build(const ImageData& image);
+    void clear();
+
+    inline bool empty() const
+    {
+        return !base;
+    }
+
+    // level 0 included
+    inline size_t n_levels() const
+    {
+        return base ? levels.size() + 1 : 0;
+    }
+
+    // level `i` is 2^i times smaller than the image
+    inline const ImageData& level(size_t i) const
+    {
+        return i ? levels[i - 1] : *base;
+    }
+
+    // the smallest level that still has a pixel for every screen pixel,
+    // when the image is drawn `scale` times its size
+    size_t level_for(double scale) const;
+
+private:
+    const ImageData* base = nullptr;
+    std::vector<ImageData> levels;      // from level 1 on
+};
+
+#endif // IMAGE_PYRAMID_H
@@ -0,0 +1,191 @@
+#include "image_snapshot.h"
+
+#include <algorithm>
+#include <cstring>
+
+ImageSnapshot::ImageSnapshot()
+    : n_channels(0), height(0), width(0), tiles_x(0), tiles_y(0)
+{}
+
+bool ImageSnapshot::same_size(const ImageSnapshot* other) const
+{
+    return other && !other->empty() && other->n_channels == n_channels &&
+        other->height == height && other->width == width;
+}
+
+void ImageSnapshot::tile_rect(size_t i, uint16_t& channel, uint32_t& x,
+    uint32_t& y, uint32_t& w, uint32_t& h) const
+{
+    size_t per_channel = (size_t)tiles_x * tiles_y;
+    channel = i / per_channel;
+    x = i % per_channel % tiles_x * TILE_SIZE;
+    y = i % per_channel / tiles_x * TILE_SIZE;
+    w = std::min(TILE_SIZE, width - x);
+    h = std::min(TILE_SIZE, height - y);
+}
+
+size_t ImageSnapshot::tile_bytes(size_t i) const
+{
+    uint16_t channel;
+    uint32_t x, y, w, h;
+    tile_rect(i, channel, x, y, w, h);
+    return (size_t)w * h;
+}
+
+void ImageSnapshot::take(const ImageData& image, const ImageSnapshot* previous)
+{
+    n_channels = image.n_channels;
+    height = image.height;
+    width = image.width;
+    tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+    tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+
+    bool share = same_size(previous);
+    std::vector<std::shared_ptr<const uint8_t[]>> taken(
+        (size_t)n_channels * tiles_x * tiles_y);
+
+    for (size_t i = 0; i < taken.size(); ++i)
+    {
+        uint16_t channel;
+        uint32_t x, y, w, h;
+        tile_rect(i, channel, x, y, w, h);
+
+        if (share)
+        {
+            const uint8_t* old = previous->tiles[i].get();
+            bool same = true;
+            for (uint32_t r = 0; r < h && same; ++r)
+                same = !memcmp(old + (size_t)r * w,
+                    image.row(channel, y + r) + x, w);
+
+            if (same)
+            {
+                taken[i] = previous->tiles[i];
+                continue;
+            }
+        }
+
+        auto tile = std::make_shared_for_overwrite<uint8_t[]>((size_t)w * h);
+        for (uint32_t r = 0; r < h; ++r)
+            memcpy(tile.get() + (size_t)r * w, image.row(channel, y + r) + x,
+                w);
+        taken[i] = std::move(tile);
+    }
+
+    // `previous` may be this snapshot
+    tiles = std::move(taken);
+}
+
+void ImageSnapshot::restore(ImageData& image, const ImageSnapshot* current) const
+{
+    bool partial = same_size(current) && image.n_channels == n_channels &&
+        image.height == height && image.width == width;
+    if (!partial)
+        image.allocate(n_channels, height, width);
+
+    for (size_t i = 0; i < tiles.size(); ++i)
+    {
+        if (partial && current->tiles[i] == tiles[i])
+            continue;
+
+        uint16_t channel;
+        uint32_t x, y, w, h;
+        tile_rect(i, channel, x, y, w, h);
+
+        for (uint32_t r = 0; r < h; ++r)
+            memcpy(image.row(channel, y + r) + x,
+                tiles[i].get() + (size_t)r * w, w);
+    }
+}
+
+void ImageSnapshot::clear()
+{
+    n_channels = 0;
+    height = width = 0;
+    tiles_x = tiles_y = 0;
+    tiles.clear();
+}
+
+size_t ImageSnapshot::owned_bytes() const
+{
+    size_t bytes = 0;
+    for (size_t i = 0; i < tiles.size(); ++i)
+        if (tiles[i].use_count() == 1)
+            bytes += tile_bytes(i);
+
+    return bytes;
+}
+
+SnapshotHistory::SnapshotHistory(size_t budget)
+    : current(NONE), budget(budget), used(0)
+{}
+
+void SnapshotHistory::set_budget(size_t bytes)
+{
+    budget = bytes;
+    fit_budget();
+}
+
+void SnapshotHistory::clear()
+{
+    snapshots.clear();
+    current = NONE;
+    used = 0;
+}
+
+void SnapshotHistory::drop(size_t step)
+{
+    used -= snapshots[step].owned_bytes();
+    snapshots[step].clear();
+}
+
+void SnapshotHistory::record(size_t step, const ImageData& image)
+{
+    // one at a time, tiles shared between the dropped ones are owned by
+    // the last of them
+    for (size_t i = snapshots.size(); i > step; --i)
+        drop(i - 1);
+    snapshots.resize(step + 1);
+
+    // tiles are shared with the closest kept step before this one
+    const ImageSnapshot* previous = nullptr;
+    for (size_t i = step; i > 0 && !previous; --i)
+        if (!snapshots[i - 1].empty())
+            previous = &snapshots[i - 1];
+
+    snapshots[step].take(image, previous);
+    used += snapshots[step].owned_bytes();
+    current = step;
+
+    fit_budget();
+}
+
+bool SnapshotHistory::restore(size_t step, ImageData& image, size_t& restored)
+{
+    if (step >= snapshots.size())
+        step = snapshots.size() - 1;
+
+    for (size_t i = step + 1; i > 0; --i)
+    {
+        if (snapshots[i - 1].empty())
+            continue;
+
+        const ImageSnapshot* now = current < snapshots.size() ?
+            &snapshots[current] : nullptr;
+        snapshots[i - 1].restore(image, now);
+
+        restored = current = i - 1;
+        return true;
+    }
+
+    return false;
+}
+
+void SnapshotHistory::fit_budget()
+{
+    // the oldest go first, the newest one and the one the image is at are
+    // always kept
+    for (size_t i = 0; i + 1 < snapshots.size() && used > budget; ++i)
+        if (i != current)
+            drop(i);
+}
@@ -0,0 +1,101 @@
+#ifndef IMAGE_SNAPSHOT_H
+#define IMAGE_SNAPSHOT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "image.h"
+
+// Copy of an image split into tiles. Tiles that are the same as in the
+// snapshot it was taken after are shared with it rather than copied, so a
+// snapshot after a processing step only costs the tiles the step changed
+class ImageSnapshot
+{
+public:
+    static constexpr uint32_t TILE_SIZE = 256;
+
+    ImageSnapshot();
+
+    // `previous` may be null or of a different size, then nothing is shared
+    void take(const ImageData& image, const ImageSnapshot* previous);
+    // `image` is known to have the pixels of `current` if that isn't null,
+    // only the tiles that differ between the two are copied
+    void restore(ImageData& image, const ImageSnapshot* current) const;
+    void clear();
+
+    inline bool empty() const
+    {
+        return tiles.empty();
+    }
+
+    // bytes of the tiles that aren't shared with any other snapshot
+    size_t owned_bytes() const;
+
+private:
+    uint16_t n_channels;
+    uint32_t height;
+    uint32_t width;
+    uint32_t tiles_x;
+    uint32_t tiles_y;
+    // by channel, then by tile row, then by tile column. Tile rows are
+    // packed, `tile_width` bytes long
+    std::vector<std::shared_ptr<const uint8_t[]>> tiles;
+
+    bool same_size(const ImageSnapshot*) const;
+    size_t tile_bytes(size_t i) const;
+    // position and size of tile `i` in the image
+    void tile_rect(size_t i, uint16_t& channel, uint32_t& x, uint32_t& y,
+        uint32_t& w, uint32_t& h) const;
+};
+
+// Snapshots of the image after every step of the processing history, step 0
+// being the image before any of them. Once the snapshots take more than the
+// budget, the oldest are dropped, the image at those steps then has to be
+// replayed from an earlier one
+class SnapshotHistory
+{
+public:
+    explicit SnapshotHistory(size_t budget = (size_t)512 << 20);
+
+    void set_budget(size_t bytes);
+    void clear();
+
+    // `image` is the result of `step`, snapshots after it are dropped
+    void record(size_t step, const ImageData& image);
+
+    // Restores the latest kept snapshot up to `step` into `image`, setting
+    // `restored` to its step. False if there is none
+    bool restore(size_t step, ImageData& image, size_t& restored);
+
+    // the image got changed without being recorded
+    inline void invalidate()
+    {
+        current = NONE;
+    }
+
+    inline bool has(size_t step) const
+    {
+        return step < snapshots.size() && !snapshots[step].empty();
+    }
+
+    // memory of the kept snapshots, shared tiles counted once
+    inline size_t memory() const
+    {
+        return used;
+    }
+
+private:
+    static constexpr size_t NONE = (size_t)-1;
+
+    std::vector<ImageSnapshot> snapshots;   // by step, empty once dropped
+    size_t current;                         // step the image is at
+    size_t budget;
+    size_t used;
+
+    void drop(size_t step);
+    void fit_budget();
+};
+
+#endif // IMAGE_SNAPSHOT_H
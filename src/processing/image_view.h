@@ -0,0 +1,67 @@
+#ifndef IMAGE_VIEW_H
+#define IMAGE_VIEW_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#include "image.h"
+
+// Non-owning view of a rectangle of planar 8 bit pixels. Copying or slicing
+// a view never copies pixels, whatever owns them has to outlive the view
+struct ImageView
+{
+    uint8_t* data = nullptr;    // first pixel of the first channel
+    uint16_t n_channels = 0;
+    uint32_t height = 0;
+    uint32_t width = 0;
+    size_t stride = 0;          // bytes from one row to the next
+    size_t plane_stride = 0;    // bytes from one channel to the next
+
+    ImageView() = default;
+
+    ImageView(uint8_t* data, uint32_t width, uint32_t height, size_t stride,
+        uint16_t n_channels = 1, size_t plane_stride = 0)
+        : data(data), n_channels(n_channels), height(height), width(width),
+        stride(stride), plane_stride(plane_stride)
+    {}
+
+    // the whole image
+    ImageView(ImageData& image)
+        : data(image.n_channels ? image.plane(0) : nullptr),
+        n_channels(image.n_channels), height(image.height),
+        width(image.width), stride(image.stride),
+        plane_stride(image.plane_size())
+    {}
+
+    inline uint8_t* row(uint16_t channel, uint32_t r) const
+    {
+        return data + plane_stride * channel + stride * r;
+    }
+
+    // `w` x `h` rectangle at `x`, `y`, cut down to what's inside this view
+    inline ImageView sub(uint32_t x, uint32_t y, uint32_t w, uint32_t h) const
+    {
+        x = std::min(x, width);
+        y = std::min(y, height);
+        w = std::min(w, width - x);
+        h = std::min(h, height - y);
+
+        return ImageView(data + stride * y + x, w, h, stride, n_channels,
+            plane_stride);
+    }
+
+    // a single channel of this view
+    inline ImageView channel(uint16_t channel) const
+    {
+        return ImageView(row(channel, 0), width, height, stride, 1,
+            plane_stride);
+    }
+
+    inline bool empty() const
+    {
+        return !width || !height || !n_channels;
+    }
+};
+
+#endif // IMAGE_VIEW_H
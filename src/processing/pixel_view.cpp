@@ -1,112 +1,532 @@
 #include "pixel_view.h"
 
-PixelView_3x3::PixelView_3x3(const ImageData& image)
-    : image(image)
-{}
+#include <array>
+#include <cstring>
+#include <vector>
+
+#include "thread_pool.h"
+#include "tile_grid.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-bool PixelView_3x3::check_pixel_color(Point coord, unsigned color, bool out_of_bounds_value) const
+using Rule = PixelView_3x3::Rule;
+using BorderSide = PixelView_3x3::BorderSide;
+
+// the neighbours of a code by name
+struct Neighbours
 {
-    if (coord.x < 0 || coord.x > image.width ||
-        coord.y < 0 || coord.y > image.height)
-        return out_of_bounds_value;
+    bool tl, t, tr, l, r, bl, b, br;
 
-    return image.channels_data[0][coord.to_linear(image.width)] == color;
-}
+    Neighbours(unsigned code)
+        : tl(code & PixelView_3x3::NB_TL), t(code & PixelView_3x3::NB_T),
+        tr(code & PixelView_3x3::NB_TR), l(code & PixelView_3x3::NB_L),
+        r(code & PixelView_3x3::NB_R), bl(code & PixelView_3x3::NB_BL),
+        b(code & PixelView_3x3::NB_B), br(code & PixelView_3x3::NB_BR)
+    {}
+};
 
-unsigned PixelView_3x3::count_adjacent(unsigned idx, unsigned color) const
+template<class Fn>
+static Rule make_rule(Fn interior, bool edge_all)
 {
-    unsigned count = 0;
+    Rule rule;
+    for (unsigned code = 0; code < 256; ++code)
+    {
+        rule.interior[code] = interior(Neighbours(code));
+        rule.edge[code] = edge_all ? code == 255 : rule.interior[code];
+    }
 
-    Point coord = Point::from_linear(idx, image.width);
-    bool oob_value = true;
+    rule.used = 0;
+    for (unsigned code = 0; code < 256; ++code)
+        for (unsigned bit = 1; bit < 256; bit <<= 1)
+            if (rule.interior[code] != rule.interior[code ^ bit] ||
+                rule.edge[code] != rule.edge[code ^ bit])
+                rule.used |= bit;
+    return rule;
+}
 
-    count +=
-        (unsigned)check_pixel_color(coord.offset(-1, -1), color, oob_value) +
-        (unsigned)check_pixel_color(coord.offset( 0, -1), color, oob_value) +
-        (unsigned)check_pixel_color(coord.offset( 1, -1), color, oob_value) +
-        (unsigned)check_pixel_color(coord.offset(-1,  0), color, oob_value) +
-        (unsigned)check_pixel_color(coord.offset( 1,  0), color, oob_value) +
-        (unsigned)check_pixel_color(coord.offset(-1,  1), color, oob_value) +
-        (unsigned)check_pixel_color(coord.offset( 0,  1), color, oob_value) +
-        (unsigned)check_pixel_color(coord.offset( 1,  1), color, oob_value);
+// `make(side)` for every side
+template<class Fn>
+static std::array<Rule, 4> make_rules(Fn make)
+{
+    return {make(PixelView_3x3::TOP), make(PixelView_3x3::RIGHT),
+        make(PixelView_3x3::BOTTOM), make(PixelView_3x3::LEFT)};
+}
 
-    return count;
+const Rule& PixelView_3x3::fill_rule()
+{
+    static const Rule rule = make_rule([](Neighbours n)
+        {
+            return n.tl + n.t + n.tr + n.l + n.r + n.bl + n.b + n.br >= 5;
+        }, true);
+    return rule;
 }
 
-bool PixelView_3x3::is_letter_border(unsigned idx, BorderSide side) const
+// a matching pixel on the opposite side and not on this one
+const Rule& PixelView_3x3::border_rule(BorderSide side)
 {
-    unsigned color = 0;
-    bool oob_value = true;
+    static const std::array<Rule, 4> rules = make_rules([](BorderSide side)
+        {
+            return make_rule([side](Neighbours n)
+                {
+                    switch (side)
+                    {
+                    case TOP:
+                        return !n.t && n.b;
+                    case RIGHT:
+                        return !n.r && n.l;
+                    case BOTTOM:
+                        return !n.b && n.t;
+                    case LEFT:
+                        return !n.l && n.r;
+                    }
+                    return false;
+                }, false);
+        });
+    return rules[side];
+}
 
-    Point coord = Point::from_linear(idx, image.width);
-    bool tl = check_pixel_color(coord.offset(-1, -1), color, oob_value);//not used in right, bottom
-    bool t  = check_pixel_color(coord.offset( 0, -1), color, oob_value);
-    bool tr = check_pixel_color(coord.offset( 1, -1), color, oob_value);//not used in bottom, left
-    bool l  = check_pixel_color(coord.offset(-1,  0), color, oob_value);
-    bool r  = check_pixel_color(coord.offset( 1,  0), color, oob_value);
-    bool bl = check_pixel_color(coord.offset(-1,  1), color, oob_value);//not used in top, right
-    bool b  = check_pixel_color(coord.offset( 0,  1), color, oob_value);
-    bool br = check_pixel_color(coord.offset( 1,  1), color, oob_value);//not used in top, left
+const Rule& PixelView_3x3::irregularity_rule(BorderSide side)
+{
+    static const std::array<Rule, 4> rules = make_rules([](BorderSide side)
+        {
+            return make_rule([side](Neighbours n)
+                {
+                    // TODO: do these actually account for stray pixels?
+                    switch (side)
+                    {
+                    case TOP: // TODO: should this also have br somewhere?
+                        return !n.tr && !n.t && !n.tl && !n.l && !n.r &&
+                            (!n.bl || n.b);
+                    case RIGHT:
+                        return !n.b && !n.br && !n.r && !n.tr && !n.t &&
+                            (!n.tl || n.l);
+                    case BOTTOM:
+                        return !n.l && !n.bl && !n.b && !n.br && !n.r &&
+                            (!n.tr || n.t);
+                    case LEFT:
+                        return !n.t && !n.tl && !n.l && !n.bl && !n.b &&
+                            (!n.br || n.r);
+                    }
+                    return false;
+                }, false);
+        });
+    return rules[side];
+}
 
-    // the pixel being checked here is assumed to have a value of "color"
+PixelView_3x3::ScanOrder PixelView_3x3::scan_order(BorderSide side)
+{
     switch (side)
     {
     case TOP:
+        return BOTTOM_UP;
+    case LEFT:
+        return RIGHT_TO_LEFT;
+    default:
+        return TOP_DOWN;
+    }
+}
+
+PixelView_3x3::PixelView_3x3(const ImageView& image)
+    : image(image)
+{}
+
+uint8_t PixelView_3x3::code(uint32_t x, uint32_t y, uint8_t match) const
+{
+    // offsets of the neighbours in the order of their bits
+    static const int dx[8] = {-1, 0, 1, -1, 1, -1, 0, 1};
+    static const int dy[8] = {-1, -1, -1, 0, 0, 1, 1, 1};
+
+    uint8_t code = 0;
+    for (unsigned i = 0; i < 8; ++i)
     {
-        bool is_top = !t && b;
-        return is_top || is_top && (!tr && l || !tl && r && l && r);
+        int64_t c = (int64_t)x + dx[i];
+        int64_t r = (int64_t)y + dy[i];
+        bool matches = c < 0 || c >= image.width || r < 0 ||
+            r >= image.height || image.row(0, r)[c] == match;
+        code |= (uint8_t)matches << i;
     }
-        break;
-    case RIGHT:
+
+    return code;
+}
+
+void PixelView_3x3::row_codes(const uint8_t* row, size_t stride,
+    uint32_t width, uint8_t match, uint8_t* codes)
+{
+    row_codes(row - stride, row, row + stride, width, match, codes);
+}
+
+#ifdef __SSE2__
+// `code` with bit `b` set for the pixels from `p` on that match, only if
+// `used` has it
+template<uint8_t used, uint8_t b>
+static inline __m128i add_bit(__m128i code, const uint8_t* p, __m128i match)
+{
+    if constexpr (!(used & b))
+        return code;
+
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+    return _mm_or_si128(code, _mm_and_si128(_mm_cmpeq_epi8(v, match),
+        _mm_set1_epi8((char)b)));
+}
+#endif
+
+template<uint8_t used, uint8_t b>
+static inline uint8_t bit_of(const uint8_t* p, uint8_t match)
+{
+    if constexpr (!(used & b))
+        return 0;
+    return *p == match ? b : 0;
+}
+
+// row_codes() with only the neighbours in `used`, the other bits are 0
+template<uint8_t used>
+static void make_codes(const uint8_t* above, const uint8_t* row,
+    const uint8_t* below, uint32_t width, uint8_t match, uint8_t* codes)
+{
+    using V = PixelView_3x3;
+    int64_t x = 0;
+
+#ifdef __SSE2__
+    const __m128i m = _mm_set1_epi8((char)match);
+
+    for (; x + 16 <= width; x += 16)
     {
-        bool is_right = !r && l;
-        return is_right || is_right && (!br && t || !tr && b || t && b);
+        __m128i code = _mm_setzero_si128();
+        code = add_bit<used, V::NB_TL>(code, above + x - 1, m);
+        code = add_bit<used, V::NB_T>(code, above + x, m);
+        code = add_bit<used, V::NB_TR>(code, above + x + 1, m);
+        code = add_bit<used, V::NB_L>(code, row + x - 1, m);
+        code = add_bit<used, V::NB_R>(code, row + x + 1, m);
+        code = add_bit<used, V::NB_BL>(code, below + x - 1, m);
+        code = add_bit<used, V::NB_B>(code, below + x, m);
+        code = add_bit<used, V::NB_BR>(code, below + x + 1, m);
+        _mm_storeu_si128((__m128i*)(codes + x), code);
     }
-        break;
-    case BOTTOM:
+#endif
+
+    for (; x < width; ++x)
+        codes[x] = bit_of<used, V::NB_TL>(above + x - 1, match) |
+            bit_of<used, V::NB_T>(above + x, match) |
+            bit_of<used, V::NB_TR>(above + x + 1, match) |
+            bit_of<used, V::NB_L>(row + x - 1, match) |
+            bit_of<used, V::NB_R>(row + x + 1, match) |
+            bit_of<used, V::NB_BL>(below + x - 1, match) |
+            bit_of<used, V::NB_B>(below + x, match) |
+            bit_of<used, V::NB_BR>(below + x + 1, match);
+}
+
+void PixelView_3x3::row_codes(const uint8_t* above, const uint8_t* row,
+    const uint8_t* below, uint32_t width, uint8_t match, uint8_t* codes)
+{
+    make_codes<0xff>(above, row, below, width, match, codes);
+}
+
+// One row, or a part of it, `dir` is 1 going right and -1 going left.
+// The codes are made up front, none of the pixels they come from changes
+// while the row is scanned, except for the neighbour behind the scan. That
+// one is carried along from one pixel to the next. `left` and `right` are
+// the tables of the leftmost and the rightmost pixel. Only the neighbours
+// in `used` are read, without the one behind nothing is carried
+template<int dir, uint8_t used>
+static bool apply_row(const uint8_t* above, uint8_t* row, const uint8_t* below,
+    uint32_t width, const bool* table, const bool* left, const bool* right,
+    uint8_t match, uint8_t value, uint8_t* codes)
+{
+    make_codes<used>(above, row, below, width, match, codes);
+
+    constexpr uint8_t behind_bit = dir > 0 ? PixelView_3x3::NB_L :
+        PixelView_3x3::NB_R;
+    constexpr bool carried = used & behind_bit;
+    const bool changed = value == match;
+    bool processed = false;
+    bool behind;
+
+    auto visit = [&](int64_t x, const bool* rule)
     {
-        bool is_bottom = !b && t;
-        return is_bottom || is_bottom && (!bl && r || !br && l || r && l);
+        uint8_t code = codes[x];
+        if constexpr (carried)
+            code = (code & ~behind_bit) | behind * behind_bit;
+        bool hit = row[x] != value && rule[code];
+        row[x] = hit ? value : row[x];
+        if constexpr (carried)
+            behind = hit ? changed : row[x] == match;
+        processed = processed || hit;
+    };
+
+    int64_t first = dir > 0 ? 0 : width - 1;
+    int64_t last = dir > 0 ? width - 1 : 0;
+    behind = row[first - dir] == match;
+
+    if (width == 1)
+    {   // it's both the leftmost and the rightmost pixel
+        visit(first, left == table ? right : left);
+        return processed;
     }
-        break;
-    case LEFT:
+    visit(first, dir > 0 ? left : right);
+
+    int64_t x = first + dir;
+#ifdef __SSE2__
+    // most pixels are `value` already, they stay as they are and a run of
+    // them only leaves whether `value` matches behind
+    const __m128i v = _mm_set1_epi8((char)value);
+    for (; dir > 0 ? x + 16 < (int64_t)width : x >= 16; x += 16 * dir)
     {
-        bool is_left = !l && r;
-        return is_left || is_left && (!tl && b || ~bl && t || t && b);
+        const uint8_t* p = row + (dir > 0 ? x : x - 15);
+        __m128i same = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), v);
+        if (_mm_movemask_epi8(same) == 0xffff)
+            behind = changed;
+        else
+            for (int64_t i = 0; i < 16; ++i)
+                visit(x + i * dir, table);
     }
-        break;
+#endif
+    for (; x != last; x += dir)
+        visit(x, table);
+    visit(last, dir > 0 ? right : left);
+
+    return processed;
+}
+
+using RowFn = bool (*)(const uint8_t*, uint8_t*, const uint8_t*, uint32_t,
+    const bool*, const bool*, const bool*, uint8_t, uint8_t, uint8_t*);
+
+template<uint8_t used>
+static RowFn row_fn(PixelView_3x3::ScanOrder order)
+{
+    if (order == PixelView_3x3::RIGHT_TO_LEFT)
+        return apply_row<-1, used>;
+    return apply_row<1, used>;
+}
+
+// apply_row() made for what the rules above look at, every side gets its
+// own, and for every other rule the one reading all the neighbours
+static RowFn row_fn(const Rule& rule, PixelView_3x3::ScanOrder order)
+{
+    using V = PixelView_3x3;
+    constexpr uint8_t all = 0xff;
+
+    switch (rule.used)
+    {
+    case V::NB_T | V::NB_B:
+        return row_fn<V::NB_T | V::NB_B>(order);
+    case V::NB_L | V::NB_R:
+        return row_fn<V::NB_L | V::NB_R>(order);
+    case all & ~V::NB_BR:
+        return row_fn<all & ~V::NB_BR>(order);
+    case all & ~V::NB_BL:
+        return row_fn<all & ~V::NB_BL>(order);
+    case all & ~V::NB_TL:
+        return row_fn<all & ~V::NB_TL>(order);
+    case all & ~V::NB_TR:
+        return row_fn<all & ~V::NB_TR>(order);
     default:
-        return false;
+        return row_fn<all>(order);
     }
 }
 
-bool PixelView_3x3::is_irregularity(unsigned idx, BorderSide side) const
+bool PixelView_3x3::apply(const Rule& rule, uint8_t match, uint8_t value,
+    ScanOrder order)
+{
+    return apply_repeated(rule, match, value, order, 1) != 0;
+}
+
+// Rows of `src` into `dst`, both can be views of an ImageData with an apron
+static void copy_rows(const ImageView& dst, const ImageView& src)
 {
-    unsigned color = 0;
-    bool oob_value = true;
+    ThreadPool::global().parallel_for(0, src.height, TileGrid::TILE_HEIGHT,
+        [&](size_t from, size_t to)
+        {
+            for (size_t y = from; y < to; ++y)
+                memcpy(dst.row(0, y), src.row(0, y), src.width);
+        });
+}
 
-    Point coord = Point::from_linear(idx, image.width);
-    bool tl = check_pixel_color(coord.offset(-1, -1), color, oob_value);
-    bool t  = check_pixel_color(coord.offset( 0, -1), color, oob_value);
-    bool tr = check_pixel_color(coord.offset( 1, -1), color, oob_value);
-    bool l  = check_pixel_color(coord.offset(-1,  0), color, oob_value);
-    bool r  = check_pixel_color(coord.offset( 1,  0), color, oob_value);
-    bool bl = check_pixel_color(coord.offset(-1,  1), color, oob_value);
-    bool b  = check_pixel_color(coord.offset( 0,  1), color, oob_value);
-    bool br = check_pixel_color(coord.offset( 1,  1), color, oob_value);
+// The processing goes on a copy with an apron of matching pixels, the
+// pixels by the edges are no different from the rest then. The passes go
+// over it a TileGrid tile at a time, on all the threads
+size_t PixelView_3x3::apply_repeated(const Rule& rule, uint8_t match,
+    uint8_t value, ScanOrder order, size_t max_passes)
+{
+    uint32_t width = image.width;
+    uint32_t height = image.height;
+    if (!width || !height)
+        return 0;
 
-    // the pixel being checked here is assumed to have a value of "color"
-    switch (side)
-    { // TODO: do these actually account for stray pixels?
-    case TOP:
-        return !tr && !t && !tl && !l && !r && (!bl || b); // TODO: should this also have br somewhere?
-    case RIGHT:
-        return !b && !br && !r && !tr && !t && (!tl || l);
-    case BOTTOM:
-        return !l && !bl && !b && !br && !r && (!tr || t);
-    case LEFT:
-        return !t && !tl && !l && !bl && !b && (!br || r);
-    default:
-        return false;
+    ImageData padded;
+    padded.allocate(1, height, width, 1);
+    padded.set_apron(match);
+    ImageView view(padded);
+    copy_rows(view, image);
+
+    TileGrid grid(width, height, order);
+    DirtyTileRows dirty(height, grid.n_cols());
+    const int step = order == BOTTOM_UP ? -1 : 1;
+    const RowFn apply_fn = row_fn(rule, order);
+
+    auto process_tile = [&](const TileGrid::Tile& tile)
+    {
+        std::vector<uint8_t> codes;
+        bool processed = false;
+
+        for (uint32_t i = 0; i < tile.height; ++i)
+        {
+            uint32_t y = step > 0 ? tile.y + i : tile.y + tile.height - 1 - i;
+            uint32_t from, to;
+            grid.span(tile, y, from, to);
+            if (from == to || !dirty.visit(y, tile.col))
+                continue;
+
+            bool edge_row = y == 0 || y + 1 == height;
+            const bool* table = edge_row ? rule.edge : rule.interior;
+            const bool* left = from ? table : rule.edge;
+            const bool* right = to < width ? table : rule.edge;
+            uint8_t* row = padded.row(0, y) + from;
+            const uint8_t* above = row - padded.stride;
+            const uint8_t* below = row + padded.stride;
+            codes.resize(to - from);
+
+            if (apply_fn(above, row, below, to - from, table, left, right,
+                match, value, codes.data()))
+            {
+                dirty.changed(y, tile.col, y + step);
+                processed = true;
+            }
+        }
+
+        return processed;
+    };
+
+    size_t passes = 0;
+    while (passes < max_passes && grid.run(process_tile))
+        ++passes;
+
+    if (passes)
+        copy_rows(image, view);
+
+    return passes;
+}
+
+// The sides go down the image one row behind each other, every side sees
+// the rows the side before it is done with, in the state it left them.
+// Applied bottom up, the TOP rule can't change a BLACK pixel next to one it
+// changed in the row below, those need the row above to be clear. So on
+// images of only `match` and `value` pixels the rows above can be read as
+// they were before the rule instead, which is what makes it go top down.
+// Other images get the four apply() calls
+size_t PixelView_3x3::apply_sides(const Rule* const rules[4], uint8_t match,
+    uint8_t value, size_t max_passes)
+{
+    uint32_t width = image.width;
+    uint32_t height = image.height;
+    if (!width || !height)
+        return 0;
+
+    ImageData padded;
+    padded.allocate(1, height, width, 1);
+    padded.set_apron(match);
+    bool two_colors = true;
+    for (uint32_t y = 0; y < height; ++y)
+    {
+        const uint8_t* src = image.row(0, y);
+        uint8_t others = 0;
+        for (uint32_t x = 0; x < width; ++x)
+            others |= src[x] != match && src[x] != value;
+        two_colors = two_colors && !others;
+        memcpy(padded.row(0, y), src, width);
+    }
+
+    if (!two_colors)
+    {
+        size_t passes = 0;
+        while (passes < max_passes)
+        {
+            bool processed = false;
+            for (unsigned side = TOP; side <= LEFT; ++side)
+                processed = apply(*rules[side], match, value,
+                    scan_order((BorderSide)side)) || processed;
+
+            if (!processed)
+                break;
+            ++passes;
+        }
+        return passes;
     }
+
+    // the row above TOP's current one as it was before TOP changed it,
+    // with an apron pixel on both ends
+    std::vector<uint8_t> top_above(width + 2), top_row(width + 2);
+    bool top_changed_above;
+    RowFn apply_fn[4];
+    for (unsigned side = TOP; side <= LEFT; ++side)
+        apply_fn[side] = row_fn(*rules[side], scan_order((BorderSide)side));
+    std::vector<uint8_t> codes(width);
+    // a row stays dirty for the rest of the pass, the sides after the one
+    // that changed it have to see that too
+    std::vector<uint8_t> dirty(height + 2, 1), next(height + 2, 0);
+    size_t passes = 0;
+
+    while (passes < max_passes)
+    {
+        bool processed = false;
+        top_changed_above = false;
+
+        for (int64_t step = 0; step < (int64_t)height + LEFT; ++step)
+            for (unsigned side = TOP; side <= LEFT; ++side)
+            {
+                int64_t y = step - side;
+                if (y < 0 || y >= height)
+                    continue;
+                if (!dirty[y + 1])
+                {
+                    if (side == TOP)
+                        top_changed_above = false;
+                    continue;
+                }
+
+                const Rule& rule = *rules[side];
+                const bool* table = y == 0 || y + 1 == height ? rule.edge :
+                    rule.interior;
+                uint8_t* row = padded.row(0, y);
+                const uint8_t* above = row - padded.stride;
+                const uint8_t* below = row + padded.stride;
+                if (side == TOP)
+                {
+                    if (top_changed_above)
+                        above = top_above.data() + 1;
+                    memcpy(top_row.data(), row - 1, width + 2);
+                }
+
+                // TOP's scan order goes left to right, like top down
+                bool changed = apply_fn[side](above, row, below, width,
+                    table, rule.edge, rule.edge, match, value, codes.data());
+
+                if (side == TOP)
+                {
+                    top_changed_above = changed;
+                    if (changed)
+                        top_above.swap(top_row);
+                }
+
+                if (changed)
+                {
+                    for (int64_t i = y; i < y + 3; ++i)
+                        dirty[i] = next[i] = 1;
+                    processed = true;
+                }
+            }
+
+        dirty.swap(next);
+        std::fill(next.begin(), next.end(), 0);
+        if (!processed)
+            break;
+        ++passes;
+    }
+
+    if (passes)
+        for (uint32_t y = 0; y < height; ++y)
+            memcpy(image.row(0, y), padded.row(0, y), width);
+
+    return passes;
 }
@@ -1,7 +1,12 @@
 #ifndef PIXEL_VIEW_H
 #define PIXEL_VIEW_H
 
-#include "image.h"
+#include <algorithm>
+#include <vector>
+
+#include "image_view.h"
+
+// Linear indices are 64 bit, PSB images go up to 300000x300000 pixels
 
 struct Point
 {
@@ -18,22 +23,66 @@ struct Point
         return Point(this->x + x, this->y + y);
     }
 
-    inline int to_linear(unsigned width)
+    inline int64_t to_linear(uint32_t width)
     {
         return point_to_linear(*this, width);
     }
 
-    inline static Point from_linear(int coord, unsigned width)
+    inline static Point from_linear(uint64_t coord, uint32_t width)
     {
         return Point(coord % width, coord / width);
     }
 
-    static int point_to_linear(const Point& coord, unsigned width)
+    static int64_t point_to_linear(const Point& coord, uint32_t width)
+    {
+        return (int64_t)coord.y * width + coord.x;
+    }
+};
+
+// Rows left to visit when a 3x3 rule is repeated pass after pass. A pixel
+// can only come out differently than on its last visit if something in its
+// 3x3 changed since, so only the rows next to changes are dirty. With
+// `in_order` a row sees the rows visited before it as they are after this
+// pass, otherwise as they were before the pass
+struct DirtyRows
+{
+    // row `r` is at `r + 1`, the rows around the image are never visited
+    std::vector<uint8_t> dirty;
+    std::vector<uint8_t> next;
+    bool in_order;
+
+    // all the rows are dirty to begin with
+    DirtyRows(uint32_t height, bool in_order)
+        : dirty(height + 2, 1), next(in_order ? 0 : height + 2, 0),
+        in_order(in_order)
+    {}
+
+    // true if row `r` has to be visited, it's clean afterwards
+    inline bool visit(uint32_t r)
+    {
+        bool is_dirty = dirty[r + 1];
+        dirty[r + 1] = 0;
+        return is_dirty;
+    }
+
+    inline void changed(uint32_t r)
+    {
+        auto& rows = in_order ? dirty : next;
+        rows[r] = rows[r + 1] = rows[r + 2] = 1;
+    }
+
+    inline void next_pass()
     {
-        return coord.y * width + coord.x;
+        if (in_order)
+            return;
+        dirty.swap(next);
+        std::fill(next.begin(), next.end(), 0);
     }
 };
 
+// Every pixel's 3x3 neighbourhood is packed into an 8 bit code, a bit is set
+// when that neighbour matches. Neighbours outside of the image always match.
+// The rules are 256 entry tables indexed by the code
 class PixelView_3x3
 {
 public:
@@ -45,17 +94,80 @@ public:
         LEFT
     };
 
-    PixelView_3x3(const ImageData&);
+    // bits of a neighbourhood code
+    enum Neighbour : uint8_t
+    {
+        NB_TL = 1 << 0,
+        NB_T  = 1 << 1,
+        NB_TR = 1 << 2,
+        NB_L  = 1 << 3,
+        NB_R  = 1 << 4,
+        NB_BL = 1 << 5,
+        NB_B  = 1 << 6,
+        NB_BR = 1 << 7
+    };
+
+    enum ScanOrder
+    {
+        TOP_DOWN,       // rows top to bottom, pixels left to right
+        BOTTOM_UP,      // rows bottom to top, pixels left to right
+        RIGHT_TO_LEFT   // rows top to bottom, pixels right to left
+    };
 
-    unsigned count_adjacent(unsigned, unsigned) const;
-    bool is_letter_border(unsigned, BorderSide) const;
-    bool is_irregularity(unsigned, BorderSide) const;
+    struct Rule
+    {
+        bool interior[256];
+        bool edge[256];     // pixels in the first or last row or column
+        // neighbours the rule looks at, the tables are the same whatever
+        // the other bits of a code are
+        uint8_t used;
+    };
 
-private:
-    const ImageData& image;
+    // at least 5 matching neighbours, all 8 on the edges
+    static const Rule& fill_rule();
+    static const Rule& border_rule(BorderSide);
+    static const Rule& irregularity_rule(BorderSide);
+    // the order the directional rules have to be applied in
+    static ScanOrder scan_order(BorderSide);
 
-    bool check_pixel_color(Point idx, unsigned color,
-        bool out_of_bounds_value) const;
+    PixelView_3x3(const ImageView&);
+
+    // code of pixel `x`, `y` of the first channel, neighbours equal
+    // to `match` are the matching ones
+    uint8_t code(uint32_t x, uint32_t y, uint8_t match) const;
+
+    // Codes of the `width` pixels of `row`, of an image with an apron of
+    // at least 1 pixel, so every neighbour can be read
+    static void row_codes(const uint8_t* row, size_t stride, uint32_t width,
+        uint8_t match, uint8_t* codes);
+    // same with the rows above and below given separately
+    static void row_codes(const uint8_t* above, const uint8_t* row,
+        const uint8_t* below, uint32_t width, uint8_t match, uint8_t* codes);
+
+    // Sets the pixels of the first channel, that aren't `value` already
+    // and for which `rule` holds, to `value`, going in `order`. Works in
+    // place, every pixel sees the ones before it as they are after the
+    // change. False if no pixel has been changed
+    bool apply(const Rule& rule, uint8_t match, uint8_t value,
+        ScanOrder order = TOP_DOWN);
+
+    // apply() over and over, until a pass changes nothing or `max_passes`
+    // passes. Only the rows next to the previous changes are revisited.
+    // Runs on all the threads, with the same result as on one.
+    // The number of passes that changed something
+    size_t apply_repeated(const Rule& rule, uint8_t match, uint8_t value,
+        ScanOrder order, size_t max_passes);
+
+    // The rules of `rules`, indexed by BorderSide, one after the other,
+    // each in its scan_order(), in a single sweep over the image. A pass
+    // is all four of them, the result is the same as that of the four
+    // apply() calls. Only for the border and irregularity rules, with
+    // `value` not matching. The number of passes that changed something
+    size_t apply_sides(const Rule* const rules[4], uint8_t match,
+        uint8_t value, size_t max_passes);
+
+private:
+    ImageView image;
 };
 
 #endif // PIXELVIEW_H
@@ -1,6 +1,8 @@
 #ifndef PROCESSOR_API
 #define PROCESSOR_API
+#include "binary_image.h"
 #include "image.h"
+#include "image_view.h"
 
 // TODO: could implement "command" pattern instead, to discontinue a mirroring
 // "ProcCtx" hierarchy for history saving. but i'm not gonna bother
@@ -15,6 +17,20 @@ public:
     {
         return false;
     };
+
+    // works on a region of an image in place, the region's edges are
+    // treated as the image's edges. False if it isn't supported
+    virtual bool process(const ImageView& view)
+    {
+        return false;
+    };
+
+    // bit-packed version for the steps after Duotone, false if it isn't
+    // supported by the processor
+    virtual bool process(BinaryImage& image)
+    {
+        return false;
+    };
 };
 
 #endif
@@ -1,11 +1,26 @@
 #include "../common_processors.h"
+#include "../thread_pool.h"
 
-Duotone::Duotone() : split_value(127)
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// about this many pixels per task
+static constexpr size_t DUOTONE_GRAIN = 1 << 18;
+// used when the histogram doesn't point anywhere
+static constexpr unsigned DEFAULT_SPLIT = 127;
+
+Duotone::Duotone() : split_value(DEFAULT_SPLIT), histogram()
 {}
 
+// anything above 256 thresholds the same as 256, all BLACK
 void Duotone::set_split_value(unsigned value)
 {
-    split_value = value;
+    split_value = std::min(value, 256u);
 }
 
 unsigned Duotone::get_split_value() const
@@ -13,33 +28,223 @@ unsigned Duotone::get_split_value() const
     return split_value;
 }
 
-const ImageData& Duotone::get_preview() const
+void Duotone::init_preview(const ImageData& image)
+{
+    histogram.fill(0);
+    if (image.n_channels)
+        count_plane(image, histogram);
+}
+
+void Duotone::init_preview(const Histogram& histogram)
+{
+    this->histogram = histogram;
+}
+
+const Histogram& Duotone::get_histogram() const
 {
-    return preview;
+    return histogram;
 }
 
 void Duotone::clear_preview()
 {
-    preview.clear();
+    histogram.fill(0);
 }
 
-// expects the image to already be grayscaled
-bool Duotone::process(ImageData& image)
+uint64_t Duotone::black_count(unsigned split_value) const
 {
-    if (image.n_channels != 1)
-        return false;
+    uint64_t count = 0;
+    for (unsigned v = 0; v < std::min(split_value, 256u); ++v)
+        count += histogram[v];
+
+    return count;
+}
+
+// maximizes the variance between the BLACK and the WHITE values
+unsigned Duotone::otsu_split() const
+{
+    double total = 0;
+    double sum = 0;
+    for (unsigned v = 0; v < 256; ++v)
+    {
+        total += histogram[v];
+        sum += (double)v * histogram[v];
+    }
+
+    unsigned best = DEFAULT_SPLIT;
+    double best_variance = 0;
+    double black = 0;
+    double black_sum = 0;
+
+    for (unsigned split = 1; split < 256; ++split)
+    {
+        black += histogram[split - 1];
+        black_sum += (double)(split - 1) * histogram[split - 1];
+
+        double white = total - black;
+        if (!black || !white)
+            continue;
+
+        double diff = black_sum / black - (sum - black_sum) / white;
+        double variance = black * white * diff * diff;
+        if (variance > best_variance)
+        {
+            best_variance = variance;
+            best = split;
+        }
+    }
+
+    return best;
+}
+
+// The value furthest below the line from the histogram peak to the far end
+// of its longer tail. Works well when one color makes most of the image,
+// like the paper around the text of a scan
+unsigned Duotone::triangle_split() const
+{
+    int first = 0;
+    int last = 255;
+    while (first < 255 && !histogram[first])
+        ++first;
+    while (last > 0 && !histogram[last])
+        --last;
+
+    if (first >= last)
+        return DEFAULT_SPLIT;
+
+    int peak = std::max_element(histogram.begin(), histogram.end()) -
+        histogram.begin();
+    int end = peak - first > last - peak ? first : last;
+
+    double x1 = peak, y1 = histogram[peak];
+    double x2 = end, y2 = histogram[end];
+
+    int best = peak;
+    double best_dist = -1;
+    int step = end < peak ? -1 : 1;
+    for (int v = peak; v != end + step; v += step)
+    {
+        // proportional to the distance below the line
+        double dist = (y2 - y1) * v - (x2 - x1) * histogram[v] +
+            x2 * y1 - y2 * x1;
+        dist = end < peak ? -dist : dist;
+        if (dist > best_dist)
+        {
+            best_dist = dist;
+            best = v;
+        }
+    }
 
-    preview = image;
+    // the value found goes with the tail
+    return end < peak ? std::min(best + 1, 255) : best;
+}
+
+void Duotone::get_lut(uint8_t lut[256]) const
+{
+    for (unsigned v = 0; v < 256; ++v)
+        lut[v] = v >= split_value ? WHITE : BLACK;
+}
+
+void Duotone::count_values(const uint8_t* values, size_t n,
+    Histogram& histogram)
+{
+    // a few counters per value, runs of the same value don't wait on each
+    // other. Blocks are small enough for the 32 bit counters
+    constexpr size_t BLOCK = 1 << 30;
+    uint32_t counts[4][256];
+
+    for (size_t from = 0; from < n; from += BLOCK)
+    {
+        size_t to = std::min(n, from + BLOCK);
+        memset(counts, 0, sizeof(counts));
+
+        size_t i = from;
+        for (; i + 4 <= to; i += 4)
+        {
+            ++counts[0][values[i]];
+            ++counts[1][values[i + 1]];
+            ++counts[2][values[i + 2]];
+            ++counts[3][values[i + 3]];
+        }
+        for (; i < to; ++i)
+            ++counts[0][values[i]];
+
+        for (unsigned v = 0; v < 256; ++v)
+            histogram[v] += (uint64_t)counts[0][v] + counts[1][v] +
+                counts[2][v] + counts[3][v];
+    }
+}
+
+void Duotone::count_plane(const ImageData& image, Histogram& histogram)
+{
+    std::mutex mutex;
+    const uint8_t* plane = image.plane(0);
+
+    histogram.fill(0);
+    ThreadPool::global().parallel_for(0, image.plane_size(), DUOTONE_GRAIN,
+        [&](size_t from, size_t to)
+        {
+            Histogram part = {};
+            count_values(plane + from, to - from, part);
+
+            std::lock_guard lock(mutex);
+            for (unsigned v = 0; v < 256; ++v)
+                histogram[v] += part[v];
+        });
+
+    // the plane is counted whole, padding included
+    histogram[0] -= (uint64_t)(image.stride - image.width) * image.height;
+}
+
+// The threshold is a lookup table with a single step, which SIMD does as
+// a compare: max(v, split) == v gives 0xFF (WHITE) exactly where v >= split
+// and 0 (BLACK) everywhere else
+static void threshold_row(uint8_t* row, uint32_t width, unsigned split_value,
+    const uint8_t lut[256])
+{
+    // the split doesn't fit a byte, no value reaches it
+    if (split_value > 255)
+    {
+        memset(row, BLACK, width);
+        return;
+    }
 
-    std::vector<uint8_t>& pix = preview.channels_data[0];
+    uint32_t c = 0;
 
-    for (uint8_t& pixel : pix)
+#ifdef __SSE2__
+    const __m128i split = _mm_set1_epi8((char)split_value);
+    for (; c + 16 <= width; c += 16)
     {
-        if (pixel >= split_value)
-            pixel = WHITE;
-        else
-            pixel = BLACK;
+        __m128i v = _mm_loadu_si128((const __m128i*)(row + c));
+        v = _mm_cmpeq_epi8(_mm_max_epu8(v, split), v);
+        _mm_storeu_si128((__m128i*)(row + c), v);
     }
+#endif
+
+    for (; c < width; ++c)
+        row[c] = lut[row[c]];
+}
+
+bool Duotone::process(ImageData& image)
+{
+    return process(ImageView(image));
+}
+
+// expects the image to already be grayscaled
+bool Duotone::process(const ImageView& view)
+{
+    if (view.n_channels != 1)
+        return false;
+
+    uint8_t lut[256];
+    get_lut(lut);
+    size_t grain = std::max<size_t>(1, DUOTONE_GRAIN / std::max(1u, view.width));
+
+    ThreadPool::global().parallel_for(0, view.height, grain,
+        [&](size_t from, size_t to)
+        {
+            for (size_t r = from; r < to; ++r)
+                threshold_row(view.row(0, r), view.width, split_value, lut);
+        });
 
     return true;
 }
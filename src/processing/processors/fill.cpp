@@ -1,7 +1,9 @@
 #include "../common_processors.h"
 #include "../pixel_view.h"
 
-Fill::Fill() : ImageProcessor(), color(BLACK)
+#include <algorithm>
+
+Fill::Fill() : RepeatedProcessor(), color(BLACK)
 {}
 
 void Fill::set_color(unsigned color)
@@ -11,38 +13,146 @@ void Fill::set_color(unsigned color)
 
 bool Fill::process(ImageData& image)
 {
+    return process(ImageView(image));
+}
+
+bool Fill::process(const ImageView& image)
+{
+    passes = 0;
     if (image.n_channels != 1)
         return false;
 
-    bool processed = false;
+    // out of bounds pixels are counted as matching, so edge pixels need
+    // all of their neighbours to match
     PixelView_3x3 v(image);
-    auto& pixels = image.channels_data[0];
-    unsigned limit;
-    unsigned w = image.width;
-    unsigned h = image.height;
-    unsigned x, y;
+    passes = v.apply_repeated(PixelView_3x3::fill_rule(), color, color,
+        PixelView_3x3::TOP_DOWN, max_passes());
+    return passes;
+}
 
-    for (unsigned i = 0; i < pixels.size(); ++i)
+// bit sliced sum of 3 bits per position
+static inline void full_add(uint64_t a, uint64_t b, uint64_t c, uint64_t& sum,
+    uint64_t& carry)
+{
+    sum = a ^ b ^ c;
+    carry = (a & b) | (c & (a ^ b));
+}
+
+// Same rules and same raster order as the byte version, 64 pixels at a time.
+// A pixel only depends on the already filled row above, on the row below
+// and on its right neighbour as they were, and on its left neighbour as it
+// is after filling. The left neighbour chain is resolved with a prefix
+// propagation inside a word and a carry between words
+bool Fill::process(BinaryImage& image)
+{
+    passes = 0;
+    if (color != BLACK && color != WHITE)
+        return false;
+
+    // everything is done on "matches the color" bits, out of bounds
+    // pixels match
+    uint64_t flip = color == BLACK ? 0 : ~0ull;
+    auto match = [&](int64_t r, int64_t k) -> uint64_t
+    {
+        if (r < 0 || r >= image.height || k < 0 ||
+            k >= (int64_t)image.words_per_row)
+            return ~0ull;
+        return (image.row(r)[k] ^ flip) | ~image.valid_bits(k);
+    };
+    auto west = [&](int64_t r, int64_t k)
+    {
+        return match(r, k) << 1 | match(r, k - 1) >> 63;
+    };
+    auto east = [&](int64_t r, int64_t k)
     {
-        if (pixels[i] == color)
-            continue;
+        return match(r, k) >> 1 | match(r, k + 1) << 63;
+    };
 
-        x = i % w;
-        y = i / w;
+    size_t n_words = image.words_per_row;
+    uint64_t last_x = image.width - 1;
+    std::vector<uint64_t> filled(n_words);
 
-        // if it's an edge - out of bound pixels are counted as matching,
-        // so this is taken into account
-        if (x == 0 || y == 0 || x == w - 1 || y == h - 1)
-            limit = 8;
-        else
-            limit = 5;
+    // fills row `r`, false if nothing changed
+    auto fill_row = [&](int64_t r)
+    {
+        bool changed = false;
+        bool edge_row = r == 0 || r == image.height - 1;
+        // left of the first pixel is out of bounds
+        uint64_t carry = 1;
 
-        if (v.count_adjacent(i, color) >= limit)
+        for (int64_t k = 0; k < (int64_t)n_words; ++k)
         {
-            pixels[i] = color;
-            processed = true;
+            // all the neighbours, except the left one
+            uint64_t s1, c1, s2, c2, ones, c3, twos, fours;
+            full_add(west(r - 1, k), match(r - 1, k), east(r - 1, k), s1, c1);
+            full_add(east(r, k), west(r + 1, k), match(r + 1, k), s2, c2);
+            full_add(s1, s2, east(r + 1, k), ones, c3);
+            full_add(c1, c2, c3, twos, fours);
+
+            uint64_t interior = 0;
+            if (!edge_row)
+            {
+                interior = image.valid_bits(k);
+                if (k == 0)
+                    interior &= ~1ull;
+                if (k == (int64_t)n_words - 1)
+                    interior &= ~(1ull << (last_x % 64));
+            }
+
+            // edge pixels need all 8 neighbours, the rest 5 of them
+            uint64_t ge4 = fours;
+            uint64_t ge5 = fours & (twos | ones);
+            uint64_t ge7 = fours & twos & ones;
+            // enough without the left neighbour
+            uint64_t sure = interior & ge5;
+            // enough only if the left neighbour matches
+            uint64_t maybe = (interior & ge4) | (~interior & ge7);
+
+            uint64_t current = match(r, k);
+            uint64_t base = current | sure;
+
+            // pixels reached through consecutive `maybe` ones, starting
+            // right after a matching pixel
+            uint64_t g = (base << 1 | carry) & maybe;
+            uint64_t p = maybe;
+            for (int shift = 1; shift < 64; shift *= 2)
+            {
+                g |= p & (g << shift);
+                p &= p << shift;
+            }
+
+            uint64_t result = base | g;
+            carry = result >> 63;
+
+            if ((result & ~current) & image.valid_bits(k))
+                changed = true;
+            filled[k] = (result ^ flip) & image.valid_bits(k);
         }
+
+        if (!changed)
+            return false;
+
+        // the row is read as it was while it's being filled
+        std::copy(filled.begin(), filled.end(), image.row(r));
+        return true;
+    };
+
+    // the rows above are seen filled
+    DirtyRows dirty(image.height, true);
+    while (passes < max_passes())
+    {
+        bool processed = false;
+        for (int64_t r = 0; r < image.height; ++r)
+            if (dirty.visit(r) && fill_row(r))
+            {
+                dirty.changed(r);
+                processed = true;
+            }
+
+        if (!processed)
+            break;
+        ++passes;
     }
 
-    return processed;
+    return passes;
 }
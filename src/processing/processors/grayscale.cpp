@@ -1,28 +1,214 @@
 #include "../common_processors.h"
+#include "../thread_pool.h"
 
-// color weights taken from https://en.wikipedia.org/wiki/Grayscale
-// there will only be one grayscaled channel after the processing is done
-bool Grayscale::process(ImageData& image)
+#include <mutex>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define GRAYSCALE_AVX2
+#endif
+
+// Color weights taken from https://en.wikipedia.org/wiki/Grayscale, in 1/32768
+// fixed point, they sum up to exactly 32768. The result is rounded to the
+// nearest value, halves up:
+//     gray = (9798 * r + 19235 * g + 3735 * b + 16384) >> 15
+// every path below gives the exact same bytes
+static constexpr int W_R = 9798;
+static constexpr int W_G = 19235;
+static constexpr int W_B = 3735;
+static constexpr int HALF = 1 << 14;
+static constexpr int SHIFT = 15;
+
+// pixels per task of `process`
+static constexpr size_t GRAYSCALE_GRAIN = 1 << 18;
+
+using ConvertFn = void (*)(const uint8_t*, const uint8_t*, const uint8_t*,
+    uint8_t*, size_t);
+
+static void convert_scalar(const uint8_t* r, const uint8_t* g,
+    const uint8_t* b, uint8_t* gray, size_t width)
 {
-    if (image.n_channels < 3)
-        return false;
+    for (size_t i = 0; i < width; ++i)
+        gray[i] = (W_R * r[i] + W_G * g[i] + W_B * b[i] + HALF) >> SHIFT;
+}
+
+#ifdef __SSE2__
+// 8 pixels widened to 16 bits. r and g are multiplied as pairs, b is paired
+// up with 1 so the rounding half gets added by the same madd
+static inline __m128i gray_8(__m128i r, __m128i g, __m128i b)
+{
+    const __m128i w_rg = _mm_set1_epi32(W_G << 16 | W_R);
+    const __m128i w_b = _mm_set1_epi32(HALF << 16 | W_B);
+    const __m128i one = _mm_set1_epi16(1);
+
+    __m128i lo = _mm_add_epi32(
+        _mm_madd_epi16(_mm_unpacklo_epi16(r, g), w_rg),
+        _mm_madd_epi16(_mm_unpacklo_epi16(b, one), w_b));
+    __m128i hi = _mm_add_epi32(
+        _mm_madd_epi16(_mm_unpackhi_epi16(r, g), w_rg),
+        _mm_madd_epi16(_mm_unpackhi_epi16(b, one), w_b));
+
+    return _mm_packs_epi32(_mm_srli_epi32(lo, SHIFT),
+        _mm_srli_epi32(hi, SHIFT));
+}
 
-    const std::vector<uint8_t>& r = image.channels_data[0];
-    const std::vector<uint8_t>& g = image.channels_data[1];
-    const std::vector<uint8_t>& b = image.channels_data[2];
+static inline __m128i gray_16(const uint8_t* r, const uint8_t* g,
+    const uint8_t* b)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i vr = _mm_loadu_si128((const __m128i*)r);
+    __m128i vg = _mm_loadu_si128((const __m128i*)g);
+    __m128i vb = _mm_loadu_si128((const __m128i*)b);
+
+    __m128i lo = gray_8(_mm_unpacklo_epi8(vr, zero),
+        _mm_unpacklo_epi8(vg, zero), _mm_unpacklo_epi8(vb, zero));
+    __m128i hi = gray_8(_mm_unpackhi_epi8(vr, zero),
+        _mm_unpackhi_epi8(vg, zero), _mm_unpackhi_epi8(vb, zero));
 
-    std::vector<uint8_t>& gray = image.channels_data[0];
+    return _mm_packus_epi16(lo, hi);
+}
 
-    for (unsigned i = 0; i < gray.size(); ++i)
+static void convert_sse2(const uint8_t* r, const uint8_t* g,
+    const uint8_t* b, uint8_t* gray, size_t width)
+{
+    size_t i = 0;
+    for (; i + 32 <= width; i += 32)
     {
-        gray[i] = 0.299 * r[i] + 0.587 * g[i] + 0.114 * b[i];
+        // all loads before the stores, `gray` may be `r`
+        __m128i v0 = gray_16(r + i, g + i, b + i);
+        __m128i v1 = gray_16(r + i + 16, g + i + 16, b + i + 16);
+        _mm_storeu_si128((__m128i*)(gray + i), v0);
+        _mm_storeu_si128((__m128i*)(gray + i + 16), v1);
     }
 
-    for (unsigned i = 1; i < image.n_channels; ++i)
+    convert_scalar(r + i, g + i, b + i, gray + i, width - i);
+}
+#endif
+
+#ifdef GRAYSCALE_AVX2
+// same as gray_8, 16 pixels. Unpacking and packing both stay inside
+// 128 bit lanes, so the pixels come out in order
+__attribute__((target("avx2")))
+static inline __m256i gray_16_avx2(__m256i r, __m256i g, __m256i b)
+{
+    const __m256i w_rg = _mm256_set1_epi32(W_G << 16 | W_R);
+    const __m256i w_b = _mm256_set1_epi32(HALF << 16 | W_B);
+    const __m256i one = _mm256_set1_epi16(1);
+
+    __m256i lo = _mm256_add_epi32(
+        _mm256_madd_epi16(_mm256_unpacklo_epi16(r, g), w_rg),
+        _mm256_madd_epi16(_mm256_unpacklo_epi16(b, one), w_b));
+    __m256i hi = _mm256_add_epi32(
+        _mm256_madd_epi16(_mm256_unpackhi_epi16(r, g), w_rg),
+        _mm256_madd_epi16(_mm256_unpackhi_epi16(b, one), w_b));
+
+    return _mm256_packs_epi32(_mm256_srli_epi32(lo, SHIFT),
+        _mm256_srli_epi32(hi, SHIFT));
+}
+
+__attribute__((target("avx2")))
+static void convert_avx2(const uint8_t* r, const uint8_t* g,
+    const uint8_t* b, uint8_t* gray, size_t width)
+{
+    const __m256i zero = _mm256_setzero_si256();
+
+    size_t i = 0;
+    for (; i + 32 <= width; i += 32)
     {
-        image.channels_data.pop_back();
+        __m256i vr = _mm256_loadu_si256((const __m256i*)(r + i));
+        __m256i vg = _mm256_loadu_si256((const __m256i*)(g + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i*)(b + i));
+
+        __m256i lo = gray_16_avx2(_mm256_unpacklo_epi8(vr, zero),
+            _mm256_unpacklo_epi8(vg, zero), _mm256_unpacklo_epi8(vb, zero));
+        __m256i hi = gray_16_avx2(_mm256_unpackhi_epi8(vr, zero),
+            _mm256_unpackhi_epi8(vg, zero), _mm256_unpackhi_epi8(vb, zero));
+
+        _mm256_storeu_si256((__m256i*)(gray + i),
+            _mm256_packus_epi16(lo, hi));
     }
-    image.n_channels = 1;
+
+    convert_scalar(r + i, g + i, b + i, gray + i, width - i);
+}
+#endif
+
+static ConvertFn pick_convert()
+{
+#ifdef GRAYSCALE_AVX2
+    if (__builtin_cpu_supports("avx2"))
+        return convert_avx2;
+#endif
+#ifdef __SSE2__
+    return convert_sse2;
+#else
+    return convert_scalar;
+#endif
+}
+
+static const ConvertFn convert = pick_convert();
+
+// there will only be one grayscaled channel after the processing is done
+bool Grayscale::process(ImageData& image)
+{
+    if (image.n_channels < 3)
+        return false;
+
+    // planes are converted whole, zero padding stays zero
+    const uint8_t* r = image.plane(0);
+    const uint8_t* g = image.plane(1);
+    const uint8_t* b = image.plane(2);
+    uint8_t* gray = image.plane(0);
+
+    std::mutex mutex;
+    histogram.fill(0);
+
+    ThreadPool::global().parallel_for(0, image.plane_size(), GRAYSCALE_GRAIN,
+        [&](size_t from, size_t to)
+        {
+            convert(r + from, g + from, b + from, gray + from, to - from);
+
+            // still in cache, Duotone can pick its split value from this
+            // without going over the image again
+            Histogram part = {};
+            Duotone::count_values(gray + from, to - from, part);
+
+            std::lock_guard lock(mutex);
+            for (unsigned v = 0; v < 256; ++v)
+                histogram[v] += part[v];
+        });
+
+    // the padding is counted too
+    histogram[0] -= (uint64_t)(image.stride - image.width) * image.height;
+
+    image.drop_channels(1);
 
     return true;
 }
+
+// a view can't lose channels, the luminance goes to the first one
+bool Grayscale::process(const ImageView& view)
+{
+    if (view.n_channels < 3)
+        return false;
+
+    for (uint32_t r = 0; r < view.height; ++r)
+        convert_row(view.row(0, r), view.row(1, r), view.row(2, r),
+            view.row(0, r), view.width);
+
+    return true;
+}
+
+const Histogram& Grayscale::get_histogram() const
+{
+    return histogram;
+}
+
+void Grayscale::convert_row(const uint8_t* r, const uint8_t* g,
+    const uint8_t* b, uint8_t* gray, size_t width)
+{
+    convert(r, g, b, gray, width);
+}
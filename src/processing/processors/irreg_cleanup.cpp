@@ -1,74 +1,296 @@
 #include "../common_processors.h"
+#include "../pixel_view.h"
 
-IrregCleanup::IrregCleanup() : DirectionalPrcessor(PixelView_3x3::TOP), color(WHITE)
+using BorderSide = PixelView_3x3::BorderSide;
+
+IrregCleanup::IrregCleanup()
+    : DirectionalPrcessor(PixelView_3x3::TOP), color(WHITE), all_sides(false)
 {}
 
-bool IrregCleanup::process_pixel(const PixelView_3x3& view, unsigned idx,
-    uint8_t& pixel)
+bool IrregCleanup::process(ImageData& image)
+{
+    return process(ImageView(image));
+}
+
+bool IrregCleanup::process(const ImageView& image)
 {
-    if (pixel == color)
+    passes = 0;
+    if (image.n_channels != 1)
         return false;
 
-    if (view.is_irregularity(idx, side))
+    // BLACK pixels are the matching ones
+    PixelView_3x3 v(image);
+    if (all_sides)
     {
-        pixel = color;
-        return true;
+        const PixelView_3x3::Rule* rules[4];
+        for (unsigned side = PixelView_3x3::TOP; side <= PixelView_3x3::LEFT;
+            ++side)
+            rules[side] = &PixelView_3x3::irregularity_rule((BorderSide)side);
+
+        passes = v.apply_sides(rules, BLACK, color, max_passes());
+        return passes;
     }
 
-    return false;
+    passes = v.apply_repeated(PixelView_3x3::irregularity_rule(side), BLACK,
+        color, PixelView_3x3::scan_order(side), max_passes());
+    return passes;
 }
 
-bool IrregCleanup::process(ImageData& image)
+// word `k` of `row`, which is null outside of the image. Out of bounds
+// pixels count as BLACK
+static inline uint64_t word(const BinaryImage& image, const uint64_t* row,
+    int64_t k)
 {
-    if (image.n_channels != 1)
+    if (!row || k < 0 || k >= (int64_t)image.words_per_row)
+        return ~0ull;
+    return row[k] | ~image.valid_bits(k);
+}
+
+// The neighbours of word `k` of `row`, read only when they're asked for.
+// Only the first and the last word of a row need bounds checks
+template<bool checked>
+struct Neighbours
+{
+    const BinaryImage& image;
+    const uint64_t* above;
+    const uint64_t* row;
+    const uint64_t* below;
+    int64_t k;
+
+    inline uint64_t at(const uint64_t* r, int64_t i) const
+    {
+        if constexpr (checked)
+            return word(image, r, i);
+        else
+            return r[i];
+    }
+
+    inline uint64_t west(const uint64_t* r) const
+    {
+        return at(r, k) << 1 | at(r, k - 1) >> 63;
+    }
+
+    inline uint64_t east(const uint64_t* r) const
+    {
+        return at(r, k) >> 1 | at(r, k + 1) << 63;
+    }
+
+    inline uint64_t n() const
+    {
+        return at(above, k);
+    }
+
+    inline uint64_t s() const
+    {
+        return at(below, k);
+    }
+
+    inline uint64_t w() const
+    {
+        return west(row);
+    }
+
+    inline uint64_t e() const
+    {
+        return east(row);
+    }
+
+    inline uint64_t nw() const
+    {
+        return west(above);
+    }
+
+    inline uint64_t ne() const
+    {
+        return east(above);
+    }
+
+    inline uint64_t sw() const
+    {
+        return west(below);
+    }
+
+    inline uint64_t se() const
+    {
+        return east(below);
+    }
+};
+
+// pixels of a word that are irregularities on `side`, every side reads
+// only the neighbours it looks at
+template<BorderSide side, class N>
+static inline uint64_t irregular(const N& nb)
+{
+    if constexpr (side == PixelView_3x3::TOP)
+        return ~nb.ne() & ~nb.n() & ~nb.nw() & ~nb.w() & ~nb.e() &
+            (~nb.sw() | nb.s());
+    else if constexpr (side == PixelView_3x3::RIGHT)
+        return ~nb.s() & ~nb.se() & ~nb.e() & ~nb.ne() & ~nb.n() &
+            (~nb.nw() | nb.w());
+    else if constexpr (side == PixelView_3x3::BOTTOM)
+        return ~nb.w() & ~nb.sw() & ~nb.s() & ~nb.se() & ~nb.e() &
+            (~nb.ne() | nb.n());
+    else
+        return ~nb.n() & ~nb.nw() & ~nb.w() & ~nb.sw() & ~nb.s() &
+            (~nb.se() | nb.e());
+}
+
+// The BLACK irregularities on `side` of the whole `row` into `picks`,
+// false if there are none. `above` and `below` can't be null here, the
+// rows outside of the image are all BLACK
+template<BorderSide side>
+static bool irregular_row(const BinaryImage& image, const uint64_t* above,
+    const uint64_t* row, const uint64_t* below, uint64_t* picks)
+{
+    int64_t n_words = image.words_per_row;
+    uint64_t any = 0;
+
+    auto pick = [&](int64_t k)
+    {
+        picks[k] = irregular<side>(
+            Neighbours<true>{image, above, row, below, k}) & row[k];
+        any |= picks[k];
+    };
+
+    // the words in between have all of their neighbours inside the row
+    pick(0);
+    for (int64_t k = 1; k + 1 < n_words; ++k)
+    {
+        picks[k] = irregular<side>(
+            Neighbours<false>{image, above, row, below, k}) & row[k];
+        any |= picks[k];
+    }
+    if (n_words > 1)
+        pick(n_words - 1);
+
+    return any;
+}
+
+// Like with ThinLetters, clearing a pixel mostly can't make a pixel checked
+// after it match. The exception is RIGHT, where the top right neighbour
+// can be cleared first, so there the rows above are used as already
+// cleared, same as in the byte version's scan order
+template<BorderSide side>
+static size_t clear_irregularities(BinaryImage& image, size_t max_passes)
+{
+    return clear_picked_repeated(image, [&](int64_t r, int64_t k)
+        {
+            const uint64_t* above = r ? image.row(r - 1) : nullptr;
+            const uint64_t* below = r + 1 < image.height ?
+                image.row(r + 1) : nullptr;
+            return irregular<side>(
+                Neighbours<true>{image, above, image.row(r), below, k});
+        }, side == PixelView_3x3::RIGHT, max_passes);
+}
+
+bool IrregCleanup::process(BinaryImage& image)
+{
+    passes = 0;
+    if (color != WHITE)
         return false;
 
-    bool processed = false;
-    PixelView_3x3 v(image);
-    auto& pixels = image.channels_data[0];
+    if (all_sides)
+        return process_all_sides(image);
 
     switch (side)
     {
     case PixelView_3x3::TOP:
-    {
-        unsigned idx = 0;
-        for (long r = image.height - 1; r >= 0 ; --r)
-            for (unsigned c = 0; c < image.width; ++c)
-            {
-                idx = r * image.width + c;
-                processed = process_pixel(v, idx, pixels[idx]) || processed;
-            }
-    }
+        passes = clear_irregularities<PixelView_3x3::TOP>(image,
+            max_passes());
         break;
     case PixelView_3x3::RIGHT:
-        for (unsigned i = 0; i < pixels.size(); ++i)
-        {
-            processed = process_pixel(v, i, pixels[i]) || processed;
-        }
+        passes = clear_irregularities<PixelView_3x3::RIGHT>(image,
+            max_passes());
         break;
     case PixelView_3x3::BOTTOM:
-    {
-        unsigned idx = 0;
-        for (unsigned r = 0; r < image.height ; ++r)
-            for (unsigned c = 0; c < image.width; ++c)
-            {
-                idx = r * image.width + c;
-                processed = process_pixel(v, idx, pixels[idx]) || processed;
-            }
-    }
+        passes = clear_irregularities<PixelView_3x3::BOTTOM>(image,
+            max_passes());
         break;
     case PixelView_3x3::LEFT:
+        passes = clear_irregularities<PixelView_3x3::LEFT>(image,
+            max_passes());
+        break;
+    }
+
+    return passes;
+}
+
+// Same sweep as PixelView_3x3::apply_sides(), the sides go down the image
+// a row behind each other. All but RIGHT read the row above as it was
+// before they cleared it, from a copy when they did
+bool IrregCleanup::process_all_sides(BinaryImage& image)
+{
+    uint32_t height = image.height;
+    size_t n_words = image.words_per_row;
+    // the rows above the first one and below the last one
+    std::vector<uint64_t> outside(n_words, ~0ull);
+    std::vector<uint64_t> picks(n_words);
+    std::vector<uint64_t> before[4];
+    bool cleared_above[4] = {};
+    for (auto& words : before)
+        words.resize(n_words);
+    // a row stays dirty for the rest of the pass, the sides after the one
+    // that cleared it have to see that too
+    std::vector<uint8_t> dirty(height + 2, 1), next(height + 2, 0);
+
+    using PickRow = bool (*)(const BinaryImage&, const uint64_t*,
+        const uint64_t*, const uint64_t*, uint64_t*);
+    static const PickRow pick_row[4] = {
+        irregular_row<PixelView_3x3::TOP>,
+        irregular_row<PixelView_3x3::RIGHT>,
+        irregular_row<PixelView_3x3::BOTTOM>,
+        irregular_row<PixelView_3x3::LEFT>
+    };
+
+    while (passes < max_passes())
     {
-        unsigned idx = 0;
-        for (unsigned r = 0; r < image.height ; ++r)
-            for (long c = image.width - 1; c >= 0 ; --c)
+        bool processed = false;
+
+        for (int64_t step = 0; step < (int64_t)height + PixelView_3x3::LEFT;
+            ++step)
+            for (unsigned side = PixelView_3x3::TOP;
+                side <= PixelView_3x3::LEFT; ++side)
             {
-                idx = r * image.width + c;
-                processed = process_pixel(v, idx, pixels[idx]) || processed;
+                int64_t r = step - side;
+                if (r < 0 || r >= height)
+                    continue;
+                if (!dirty[r + 1])
+                {
+                    cleared_above[side] = false;
+                    continue;
+                }
+
+                uint64_t* row = image.row(r);
+                const uint64_t* above = !r ? outside.data() :
+                    cleared_above[side] ? before[side].data() :
+                    image.row(r - 1);
+                const uint64_t* below = r + 1 < height ? image.row(r + 1) :
+                    outside.data();
+
+                bool picked = pick_row[side](image, above, row, below,
+                    picks.data());
+
+                cleared_above[side] = picked &&
+                    side != PixelView_3x3::RIGHT;
+                if (!picked)
+                    continue;
+
+                if (cleared_above[side])
+                    std::copy(row, row + n_words, before[side].begin());
+                for (size_t k = 0; k < n_words; ++k)
+                    row[k] &= ~picks[k];
+
+                for (int64_t i = r; i < r + 3; ++i)
+                    dirty[i] = next[i] = 1;
+                processed = true;
             }
-    }
-        break;
+
+        dirty.swap(next);
+        std::fill(next.begin(), next.end(), 0);
+        if (!processed)
+            break;
+        ++passes;
     }
 
-    return processed;
+    return passes;
 }
@@ -1,5 +1,8 @@
 #include "../common_processors.h"
 
+#include <algorithm>
+#include <bit>
+
 #include "letters/letter_reader.h"
 
 LetterFinder::LetterFinder() : color(BLACK), idx(0)
@@ -20,7 +23,7 @@ void LetterFinder::clear()
     idx = 0;
 }
 
-static bool letters_contain(const std::vector<LetterData>& letters, unsigned idx)
+static bool letters_contain(const std::vector<LetterData>& letters, uint64_t idx)
 {
     for (auto& letter : letters)
         if (letter.pixels_idxs.contains(idx))
@@ -28,16 +31,16 @@ static bool letters_contain(const std::vector<LetterData>& letters, unsigned idx
     return false;
 }
 
-static void check_pixel(LetterData& letter, unsigned idx,
+static void check_pixel(LetterData& letter, uint64_t idx,
     const ImageData& image, unsigned letter_color)
 {
-    if (image.channels_data[0][idx] != letter_color || letter.pixels_idxs.contains(idx))
+    Point p = Point::from_linear(idx, image.width);
+
+    if (image.row(0, p.y)[p.x] != letter_color || letter.pixels_idxs.contains(idx))
         return;
 
     letter.pixels_idxs.insert(idx);
 
-    Point p = Point::from_linear(idx, image.width);
-
     if (p.x < letter.top_left.x)
         letter.top_left.x = p.x;
     if (p.x > letter.bottom_right.x)
@@ -69,7 +72,7 @@ static void check_pixel(LetterData& letter, unsigned idx,
 
 // TODO: rewrite without recursion || fortify against stack overflow
 static void trace_letter(std::vector<LetterData>& letters,
-    const ImageData& image, unsigned idx, unsigned letter_color)
+    const ImageData& image, uint64_t idx, unsigned letter_color)
 {
     LetterData& letter = letters.emplace_back();
     letter.top_left.x = letter.top_left.y = INT32_MAX;
@@ -83,12 +86,12 @@ bool LetterFinder::process(ImageData& image)
     if (image.n_channels != 1)
         return false;
 
-    auto& pixels = image.channels_data[0];
-
-    if (idx >= pixels.size())
+    if (idx >= (uint64_t)image.width * image.height)
         return false;
 
-    if (pixels[idx] == color && !letters_contain(letters, idx))
+    Point p = Point::from_linear(idx, image.width);
+
+    if (image.row(0, p.y)[p.x] == color && !letters_contain(letters, idx))
     {
         trace_letter(letters, image, idx, color);
         LetterReader::detect(letters.back(), image);
@@ -98,3 +101,85 @@ bool LetterFinder::process(ImageData& image)
 
     return true;
 }
+
+// same letters in the same order as the byte version, but traced without
+// recursion and with a bit per pixel to tell if it's already in a letter
+bool LetterFinder::process(BinaryImage& image)
+{
+    if (color != BLACK)
+        return false;
+
+    if (idx == 0 || traced.width != image.width ||
+        traced.height != image.height)
+        traced.allocate(image.height, image.width);
+
+    // next BLACK pixel that isn't in any letter yet
+    uint64_t total = (uint64_t)image.width * image.height;
+    uint64_t x = 0, y = 0;
+    bool found = false;
+    while (idx < total && !found)
+    {
+        y = idx / image.width;
+        x = idx % image.width;
+        size_t k = x / 64;
+
+        uint64_t untraced = (image.row(y)[k] & ~traced.row(y)[k]) >>
+            (x % 64);
+        if (untraced)
+        {
+            x += std::countr_zero(untraced);
+            found = true;
+        }
+        else
+        {   // the rest of the word
+            idx += 64 - x % 64;
+            if (idx / image.width != y)
+                idx = (y + 1) * image.width;
+        }
+    }
+
+    if (!found)
+    {
+        idx = total;
+        return false;
+    }
+
+    LetterData& letter = letters.emplace_back();
+    letter.top_left.x = letter.top_left.y = INT32_MAX;
+
+    std::vector<Point> stack = {Point(x, y)};
+    traced.set(x, y);
+
+    while (!stack.empty())
+    {
+        Point p = stack.back();
+        stack.pop_back();
+        letter.pixels_idxs.insert(p.to_linear(image.width));
+
+        letter.top_left.x = std::min(letter.top_left.x, p.x);
+        letter.top_left.y = std::min(letter.top_left.y, p.y);
+        letter.bottom_right.x = std::max(letter.bottom_right.x, p.x);
+        letter.bottom_right.y = std::max(letter.bottom_right.y, p.y);
+
+        for (int dy = -1; dy <= 1; ++dy)
+            for (int dx = -1; dx <= 1; ++dx)
+            {
+                Point n = p.offset(dx, dy);
+                if (n.x < 0 || n.y < 0 || n.x >= (int64_t)image.width ||
+                    n.y >= (int64_t)image.height)
+                    continue;
+
+                if (image.get(n.x, n.y) && !traced.get(n.x, n.y))
+                {
+                    traced.set(n.x, n.y);
+                    stack.push_back(n);
+                }
+            }
+    }
+
+    LetterReader::detect(letter, image);
+
+    idx = y * image.width + x + 1;
+
+    return true;
+}
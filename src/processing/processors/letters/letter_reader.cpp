@@ -44,9 +44,8 @@ static void add_group_count(std::vector<int>& vec, int num)
 }
 
 // note: extracted purely for the sake of not duplicating this code
-static void proc_pixel(unsigned idx, const LetterData& letter,
-    const std::vector<uint8_t>& image,
-    bool& seq_started, int& groups_num, int& group_start_idx)
+static void proc_pixel(uint64_t idx, const LetterData& letter, uint8_t pixel,
+    bool& seq_started, int& groups_num, int64_t& group_start_idx)
 {
     // only process pixels that are parts of the letter
     if (!letter.pixels_idxs.count(idx))
@@ -60,7 +59,7 @@ static void proc_pixel(unsigned idx, const LetterData& letter,
         return;
     }
 
-    if (image[idx] == BLACK)
+    if (pixel == BLACK)
     {
         if (!seq_started)
         {
@@ -79,19 +78,40 @@ static void proc_pixel(unsigned idx, const LetterData& letter,
     }
 }
 
-static void proc_rows(LetterData& letter, const ImageData& image)
+// the letter's bounding box out of the image, nothing outside of it is read
+struct LetterRegion
 {
-    for (unsigned r = letter.top_left.y; r <= letter.bottom_right.y; ++r)
+    ImageView view;
+    uint32_t width;     // of the whole image, for the indices
+    uint32_t x;
+    uint32_t y;
+};
+
+static inline uint8_t pixel_at(const LetterRegion& region, uint64_t r,
+    uint64_t c)
+{
+    return region.view.row(0, r - region.y)[c - region.x];
+}
+
+static inline uint8_t pixel_at(const BinaryImage& image, uint64_t r, uint64_t c)
+{
+    return image.get(c, r) ? BLACK : WHITE;
+}
+
+template<class Image>
+static void proc_rows(LetterData& letter, const Image& image)
+{
+    for (uint64_t r = letter.top_left.y; r <= letter.bottom_right.y; ++r)
     {
         int groups_num = 0;
-        int group_start_idx = -1;
-        unsigned idx = 0;
+        int64_t group_start_idx = -1;
+        uint64_t idx = 0;
         bool seq_started = false;
 
-        for (unsigned c = letter.top_left.x, idx = r * image.width + c;
+        for (uint64_t c = letter.top_left.x, idx = r * image.width + c;
             c <= letter.bottom_right.x; ++c, ++idx)
         {
-            proc_pixel(idx, letter, image.channels_data[0], seq_started,
+            proc_pixel(idx, letter, pixel_at(image, r, c), seq_started,
                 groups_num, group_start_idx);
         }
 
@@ -110,19 +130,20 @@ static void proc_rows(LetterData& letter, const ImageData& image)
     return;
 }
 
-static void proc_cols(LetterData& letter, const ImageData& image)
+template<class Image>
+static void proc_cols(LetterData& letter, const Image& image)
 {
-    for (unsigned c = letter.top_left.x; c <= letter.bottom_right.x; ++c)
+    for (uint64_t c = letter.top_left.x; c <= letter.bottom_right.x; ++c)
     {
         int groups_num = 0;
-        int group_start_idx = -1;
-        unsigned idx = 0;
+        int64_t group_start_idx = -1;
+        uint64_t idx = 0;
         bool seq_started = false;
 
-        for (unsigned r = letter.top_left.y, idx = r * image.width + c;
+        for (uint64_t r = letter.top_left.y, idx = r * image.width + c;
             r <= letter.bottom_right.y; ++r, idx += image.width)
         {
-            proc_pixel(idx, letter, image.channels_data[0], seq_started,
+            proc_pixel(idx, letter, pixel_at(image, r, c), seq_started,
                 groups_num, group_start_idx);
         }
 
@@ -150,7 +171,21 @@ static void determine_chars(LetterData& letter)
             compare_letters(letter.metrics, etalon.second), etalon.first});
 }
 
-void detect(LetterData& letter, const ImageData& image)
+void detect(LetterData& letter, const ImageView& image)
+{
+    LetterRegion region;
+    region.x = letter.top_left.x;
+    region.y = letter.top_left.y;
+    region.width = image.width;
+    region.view = image.sub(region.x, region.y, letter.width() + 1,
+        letter.height() + 1);
+
+    proc_rows(letter, region);
+    proc_cols(letter, region);
+    determine_chars(letter);
+}
+
+void detect(LetterData& letter, const BinaryImage& image)
 {
     proc_rows(letter, image);
     proc_cols(letter, image);
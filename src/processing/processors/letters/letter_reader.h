@@ -51,7 +51,9 @@ static const std::unordered_map<char, LetterData::LinesMetrics> etalons = {
     {'T', {{1, -1, 3, 1}, {1, 2, -1, 2, 1}}},
 };
 
-void detect(LetterData& letter, const ImageData& image);
+// only reads the letter's bounding box of `image`
+void detect(LetterData& letter, const ImageView& image);
+void detect(LetterData& letter, const BinaryImage& image);
 }
 
 #endif // LETTER_READER_H
@@ -0,0 +1,167 @@
+#include "../common_processors.h"
+#include "../pixel_view.h"
+#include "../thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+using Rule = PixelView_3x3::Rule;
+
+// rows per task
+static constexpr size_t SKELETON_GRAIN = 64;
+
+// The neighbours as the papers name them, P2 is the top one and the rest
+// go clockwise. Set is BLACK
+struct Ring
+{
+    bool p2, p3, p4, p5, p6, p7, p8, p9;
+
+    Ring(unsigned code)
+        : p2(code & PixelView_3x3::NB_T), p3(code & PixelView_3x3::NB_TR),
+        p4(code & PixelView_3x3::NB_R), p5(code & PixelView_3x3::NB_BR),
+        p6(code & PixelView_3x3::NB_B), p7(code & PixelView_3x3::NB_BL),
+        p8(code & PixelView_3x3::NB_L), p9(code & PixelView_3x3::NB_TL)
+    {}
+};
+
+// Zhang, Suen, "A fast parallel algorithm for thinning digital patterns"
+static bool zhang_suen(const Ring& n, bool second)
+{
+    unsigned b = n.p2 + n.p3 + n.p4 + n.p5 + n.p6 + n.p7 + n.p8 + n.p9;
+    // WHITE to BLACK going around
+    unsigned a = (!n.p2 && n.p3) + (!n.p3 && n.p4) + (!n.p4 && n.p5) +
+        (!n.p5 && n.p6) + (!n.p6 && n.p7) + (!n.p7 && n.p8) +
+        (!n.p8 && n.p9) + (!n.p9 && n.p2);
+
+    if (b < 2 || b > 6 || a != 1)
+        return false;
+
+    if (!second)
+        return !(n.p2 && n.p4 && n.p6) && !(n.p4 && n.p6 && n.p8);
+    return !(n.p2 && n.p4 && n.p8) && !(n.p2 && n.p6 && n.p8);
+}
+
+// Guo, Hall, "Parallel thinning with two-subiteration algorithms"
+static bool guo_hall(const Ring& n, bool second)
+{
+    unsigned c = (!n.p2 && (n.p3 || n.p4)) + (!n.p4 && (n.p5 || n.p6)) +
+        (!n.p6 && (n.p7 || n.p8)) + (!n.p8 && (n.p9 || n.p2));
+    unsigned n1 = (n.p9 || n.p2) + (n.p3 || n.p4) + (n.p5 || n.p6) +
+        (n.p7 || n.p8);
+    unsigned n2 = (n.p2 || n.p3) + (n.p4 || n.p5) + (n.p6 || n.p7) +
+        (n.p8 || n.p9);
+    unsigned m = std::min(n1, n2);
+
+    if (c != 1 || m < 2 || m > 3)
+        return false;
+
+    if (!second)
+        return !((n.p2 || n.p3 || !n.p5) && n.p4);
+    return !((n.p6 || n.p7 || !n.p9) && n.p8);
+}
+
+// the two subiterations of both methods
+static const Rule& subiteration_rule(Skeletonize::Method method, bool second)
+{
+    static const auto rules = []
+    {
+        std::array<Rule, 4> rules;
+        for (unsigned i = 0; i < 4; ++i)
+            for (unsigned code = 0; code < 256; ++code)
+            {
+                Ring n(code);
+                bool remove = i < 2 ? zhang_suen(n, i % 2) : guo_hall(n, i % 2);
+                rules[i].interior[code] = rules[i].edge[code] = remove;
+            }
+        return rules;
+    }();
+
+    return rules[(method == Skeletonize::GUO_HALL) * 2 + second];
+}
+
+// `dst` gets `src` with the BLACK pixels for which `rule` holds turned
+// WHITE. Both have an apron, false if nothing changed
+static bool subiteration(const ImageData& src, ImageData& dst, const Rule& rule)
+{
+    std::atomic<bool> processed(false);
+
+    ThreadPool::global().parallel_for(0, src.height, SKELETON_GRAIN,
+        [&](size_t from, size_t to)
+        {
+            std::vector<uint8_t> codes(src.width);
+            bool changed = false;
+
+            for (size_t y = from; y < to; ++y)
+            {
+                const uint8_t* in = src.row(0, y);
+                uint8_t* out = dst.row(0, y);
+                PixelView_3x3::row_codes(in, src.stride, src.width, BLACK,
+                    codes.data());
+
+                for (uint32_t x = 0; x < src.width; ++x)
+                {
+                    bool remove = in[x] == BLACK && rule.interior[codes[x]];
+                    out[x] = remove ? (uint8_t)WHITE : in[x];
+                    changed = changed || remove;
+                }
+            }
+
+            if (changed)
+                processed = true;
+        });
+
+    return processed;
+}
+
+Skeletonize::Skeletonize() : ImageProcessor(), method(ZHANG_SUEN)
+{}
+
+void Skeletonize::set_method(Method method)
+{
+    this->method = method;
+}
+
+bool Skeletonize::process(ImageData& image)
+{
+    return process(ImageView(image));
+}
+
+bool Skeletonize::process(const ImageView& image)
+{
+    if (image.n_channels != 1 || image.empty())
+        return false;
+
+    // double buffered, every subiteration reads one and writes the other
+    ImageData buffers[2];
+    for (auto& buffer : buffers)
+    {
+        buffer.allocate(1, image.height, image.width, 1);
+        buffer.set_apron(WHITE);
+    }
+    for (uint32_t y = 0; y < image.height; ++y)
+        memcpy(buffers[0].row(0, y), image.row(0, y), image.width);
+
+    bool processed = false;
+    unsigned current = 0;
+    bool changed = true;
+
+    while (changed)
+    {
+        changed = false;
+        for (bool second : {false, true})
+            if (subiteration(buffers[current], buffers[current ^ 1],
+                subiteration_rule(method, second)))
+            {
+                changed = true;
+                current ^= 1;
+            }
+        processed = processed || changed;
+    }
+
+    if (processed)
+        for (uint32_t y = 0; y < image.height; ++y)
+            memcpy(image.row(0, y), buffers[current].row(0, y), image.width);
+
+    return processed;
+}
@@ -4,72 +4,61 @@
 ThinLetters::ThinLetters() : DirectionalPrcessor(PixelView_3x3::TOP), color(WHITE)
 {}
 
-bool ThinLetters::process_pixel(const PixelView_3x3& view, unsigned idx,
-    uint8_t& pixel)
+bool ThinLetters::process(ImageData& image)
 {
-    if (pixel == color)
-        return false;
-
-    if (view.is_letter_border(idx, side))
-    {
-        pixel = color;
-        return true;
-    }
-
-    return false;
+    return process(ImageView(image));
 }
 
-bool ThinLetters::process(ImageData& image)
+bool ThinLetters::process(const ImageView& image)
 {
+    passes = 0;
     if (image.n_channels != 1)
         return false;
 
-    bool processed = false;
+    // BLACK pixels are the matching ones
     PixelView_3x3 v(image);
-    auto& pixels = image.channels_data[0];
+    passes = v.apply_repeated(PixelView_3x3::border_rule(side), BLACK,
+        color, PixelView_3x3::scan_order(side), max_passes());
+    return passes;
+}
+
+// A pixel can't be cleared by a border rule once the neighbour that would
+// let it be cleared is BLACK itself, so the scan order of the byte version
+// doesn't matter and every pixel is decided from the image as it was
+bool ThinLetters::process(BinaryImage& image)
+{
+    passes = 0;
+    if (color != WHITE)
+        return false;
 
+    // out of bounds pixels count as BLACK
     switch (side)
     {
     case PixelView_3x3::TOP:
-    {
-        unsigned idx = 0;
-        for (long r = image.height - 1; r >= 0 ; --r)
-            for (unsigned c = 0; c < image.width; ++c)
+        passes = clear_picked_repeated(image, [&](int64_t r, int64_t k)
             {
-                idx = r * image.width + c;
-                processed = process_pixel(v, idx, pixels[idx]) || processed;
-            }
-    }
+                return ~image.word(r - 1, k, true) & image.word(r + 1, k, true);
+            }, false, max_passes());
         break;
     case PixelView_3x3::RIGHT:
-        for (unsigned i = 0; i < pixels.size(); ++i)
-        {
-            processed = process_pixel(v, i, pixels[i]) || processed;
-        }
+        passes = clear_picked_repeated(image, [&](int64_t r, int64_t k)
+            {
+                return ~image.east(r, k, true) & image.west(r, k, true);
+            }, false, max_passes());
         break;
     case PixelView_3x3::BOTTOM:
-    {
-        unsigned idx = 0;
-        for (unsigned r = 0; r < image.height ; ++r)
-            for (unsigned c = 0; c < image.width; ++c)
+        passes = clear_picked_repeated(image, [&](int64_t r, int64_t k)
             {
-                idx = r * image.width + c;
-                processed = process_pixel(v, idx, pixels[idx]) || processed;
-            }
-    }
+                return ~image.word(r + 1, k, true) & image.word(r - 1, k, true);
+            }, false, max_passes());
         break;
     case PixelView_3x3::LEFT:
-    {
-        unsigned idx = 0;
-        for (unsigned r = 0; r < image.height ; ++r)
-            for (long c = image.width - 1; c >= 0 ; --c)
+        passes = clear_picked_repeated(image, [&](int64_t r, int64_t k)
             {
-                idx = r * image.width + c;
-                processed = process_pixel(v, idx, pixels[idx]) || processed;
-            }
-    }
+                return ~image.west(r, k, true) & image.east(r, k, true);
+            }, false, max_passes());
         break;
     }
 
-    return processed;
+    return passes;
 }
@@ -0,0 +1,131 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+ThreadPool::ThreadPool(unsigned n_threads)
+{
+    if (!n_threads)
+        n_threads = std::max(1u, std::thread::hardware_concurrency());
+
+    // the caller of parallel_for is one of the threads
+    for (unsigned i = 1; i < n_threads; ++i)
+        workers.emplace_back(&ThreadPool::worker_loop, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    cv.notify_all();
+
+    for (auto& worker : workers)
+        worker.join();
+}
+
+ThreadPool& ThreadPool::global()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::worker_loop()
+{
+    while (true)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock lock(mutex);
+            cv.wait(lock, [this] { return stopping || !tasks.empty(); });
+
+            if (stopping && tasks.empty())
+                return;
+
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+    }
+}
+
+void ThreadPool::enqueue(std::function<void()> task)
+{
+    {
+        std::lock_guard lock(mutex);
+        tasks.push_back(std::move(task));
+    }
+    cv.notify_one();
+}
+
+namespace
+{
+// shared between the caller and the helper tasks, helpers may only get to run
+// after parallel_for has returned, so it's kept alive by them too
+struct ForState
+{
+    size_t begin;
+    size_t end;
+    size_t grain;
+    size_t n_chunks;
+    const std::function<void(size_t, size_t)>* fn;
+
+    std::atomic<size_t> next_chunk {0};
+    std::atomic<size_t> done_chunks {0};
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    // returns after there are no more chunks to claim
+    void run()
+    {
+        size_t chunk;
+        while ((chunk = next_chunk.fetch_add(1)) < n_chunks)
+        {
+            size_t from = begin + chunk * grain;
+            size_t to = std::min(end, from + grain);
+            (*fn)(from, to);
+
+            if (done_chunks.fetch_add(1) + 1 == n_chunks)
+            {
+                std::lock_guard lock(mutex);
+                cv.notify_all();
+            }
+        }
+    }
+};
+}
+
+void ThreadPool::parallel_for(size_t begin, size_t end, size_t grain,
+    const std::function<void(size_t, size_t)>& fn)
+{
+    if (begin >= end)
+        return;
+    if (!grain)
+        grain = 1;
+
+    size_t n_chunks = (end - begin + grain - 1) / grain;
+    if (n_chunks == 1 || workers.empty())
+    {
+        for (size_t from = begin; from < end; from += grain)
+            fn(from, std::min(end, from + grain));
+        return;
+    }
+
+    auto state = std::make_shared<ForState>();
+    state->begin = begin;
+    state->end = end;
+    state->grain = grain;
+    state->n_chunks = n_chunks;
+    state->fn = &fn;
+
+    size_t helpers = std::min<size_t>(workers.size(), n_chunks - 1);
+    for (size_t i = 0; i < helpers; ++i)
+        enqueue([state] { state->run(); });
+
+    state->run();
+
+    std::unique_lock lock(state->mutex);
+    state->cv.wait(lock, [&] { return state->done_chunks == n_chunks; });
+}
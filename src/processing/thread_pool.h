@@ -0,0 +1,48 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads shared by the decoder and the processors
+class ThreadPool
+{
+public:
+    // 0 means one thread per hardware thread
+    explicit ThreadPool(unsigned n_threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    static ThreadPool& global();
+
+    // workers + the calling thread
+    inline unsigned concurrency() const
+    {
+        return workers.size() + 1;
+    }
+
+    // Calls fn(begin, end) for consecutive sub-ranges of [begin, end) of at
+    // most `grain` elements and blocks until all of them are done.
+    // The calling thread takes part in the work, so this can be nested.
+    void parallel_for(size_t begin, size_t end, size_t grain,
+        const std::function<void(size_t, size_t)>& fn);
+
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stopping = false;
+
+    void worker_loop();
+    void enqueue(std::function<void()>);
+};
+
+#endif // THREAD_POOL_H
@@ -0,0 +1,129 @@
+#include "tile_grid.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#include "thread_pool.h"
+
+TileGrid::TileGrid(uint32_t width, uint32_t height,
+    PixelView_3x3::ScanOrder order)
+    : width(width), height(height), order(order)
+{
+    // A tile column runs along the slant, across `width + height` of them.
+    // The wavefront only gets as wide as the shorter side of the grid,
+    // a couple of columns per thread keep them all going
+    uint64_t slanted = (uint64_t)width + height;
+    unsigned threads = ThreadPool::global().concurrency();
+    tile_width = threads == 1 ? slanted : std::max<uint64_t>(MIN_TILE_WIDTH,
+        slanted / (2 * threads));
+
+    cols = (slanted + tile_width - 1) / tile_width;
+    rows = std::max(1u, height / TILE_HEIGHT);
+}
+
+TileGrid::Tile TileGrid::tile(uint32_t col, uint32_t row) const
+{
+    // bands go in the scan order, the last one takes what's left
+    uint32_t first = row * TILE_HEIGHT;
+    uint32_t end = row + 1 == rows ? height : first + TILE_HEIGHT;
+
+    Tile t;
+    t.col = col;
+    t.row = row;
+    t.y = order == PixelView_3x3::BOTTOM_UP ? height - end : first;
+    t.height = end - first;
+    return t;
+}
+
+// The pixels of a column are those with `x + y` in its range, counted
+// from the corner the scan starts in
+void TileGrid::span(const Tile& tile, uint32_t y, uint32_t& from,
+    uint32_t& to) const
+{
+    int64_t i = order == PixelView_3x3::BOTTOM_UP ? height - 1 - y : y;
+    int64_t first = (int64_t)tile.col * tile_width - i;
+    int64_t last = first + tile_width;
+    if (order == PixelView_3x3::RIGHT_TO_LEFT)
+    {
+        std::swap(first, last);
+        first = width - first;
+        last = width - last;
+    }
+
+    from = std::clamp<int64_t>(first, 0, width);
+    to = std::clamp<int64_t>(last, from, width);
+}
+
+bool TileGrid::run(const std::function<bool(const Tile&)>& kernel) const
+{
+    size_t n_tiles = (size_t)cols * rows;
+
+    if (n_tiles == 1 || ThreadPool::global().concurrency() == 1)
+    {
+        bool processed = false;
+        for (uint32_t r = 0; r < rows; ++r)
+            for (uint32_t c = 0; c < cols; ++c)
+                processed = kernel(tile(c, r)) || processed;
+        return processed;
+    }
+
+    // a tile waits for the one on its left and the one above it
+    std::vector<uint8_t> waiting(n_tiles);
+    for (size_t t = 0; t < n_tiles; ++t)
+        waiting[t] = (t % cols != 0) + (t >= cols);
+    std::vector<size_t> ready = {0};
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    size_t left = n_tiles;
+    bool processed = false;
+
+    auto release = [&](size_t t)
+    {
+        if (!--waiting[t])
+            ready.push_back(t);
+    };
+
+    // as many of these as there are threads, they take the tiles as they
+    // get ready
+    auto work = [&](size_t, size_t)
+    {
+        std::unique_lock lock(mutex);
+        while (true)
+        {
+            cv.wait(lock, [&] { return !ready.empty() || !left; });
+            if (!left)
+                return;
+
+            size_t t = ready.back();
+            ready.pop_back();
+
+            lock.unlock();
+            bool changed = kernel(tile(t % cols, t / cols));
+            lock.lock();
+
+            processed = processed || changed;
+            --left;
+            if (t % cols + 1 < cols)
+                release(t + 1);
+            if (t + cols < n_tiles)
+                release(t + cols);
+            cv.notify_all();
+        }
+    };
+
+    unsigned threads = ThreadPool::global().concurrency();
+    ThreadPool::global().parallel_for(0, threads, 1, work);
+
+    return processed;
+}
+
+DirtyTileRows::DirtyTileRows(uint32_t height, uint32_t n_cols)
+    : n_cols(n_cols),
+    dirty(new std::atomic<uint8_t>[(height + 2) * (size_t)n_cols])
+{
+    for (size_t i = 0; i < (height + 2) * (size_t)n_cols; ++i)
+        dirty[i].store(1, std::memory_order_relaxed);
+}
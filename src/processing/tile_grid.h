@@ -0,0 +1,124 @@
+#ifndef TILE_GRID_H
+#define TILE_GRID_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+#include "pixel_view.h"
+
+// Splits an image into tiles for running in place 3x3 rules in a scan
+// order on all the threads of ThreadPool::global(), with the same result
+// as a single scan over the whole image, whatever the number of threads.
+//
+// A pixel has to see the neighbours before it in the scan after they're
+// done and the ones after it before they are. Going top down, that's its
+// top right neighbour done and its bottom left one not, so rectangles
+// can't do and the tiles are slanted instead: every row of a tile starts a
+// pixel to the left of the row above. A tile then only waits for the one
+// before it in its band of rows and the one above it, like in a
+// wavefront. The 1 pixel halo of a tile is read in place, the image needs
+// an apron around it for the tiles on the edges
+class TileGrid
+{
+public:
+    // rows of a band of tiles, the last band can be taller
+    static constexpr uint32_t TILE_HEIGHT = 64;
+    // tiles aren't narrower than this, unless the image is
+    static constexpr uint32_t MIN_TILE_WIDTH = 256;
+
+    struct Tile
+    {
+        uint32_t col;
+        uint32_t row;
+        // rows of the image the tile is on
+        uint32_t y;
+        uint32_t height;
+    };
+
+    // Tiles are made narrow enough for the wavefront to keep every thread
+    // busy. With a single thread a tile is a whole band of rows
+    TileGrid(uint32_t width, uint32_t height, PixelView_3x3::ScanOrder);
+
+    inline uint32_t n_cols() const
+    {
+        return cols;
+    }
+
+    inline uint32_t n_rows() const
+    {
+        return rows;
+    }
+
+    Tile tile(uint32_t col, uint32_t row) const;
+
+    // pixels [`from`, `to`) of row `y` of `tile`, it can be empty
+    void span(const Tile& tile, uint32_t y, uint32_t& from,
+        uint32_t& to) const;
+
+    // Calls `kernel` once for every tile, it goes over the rows of a tile
+    // in the scan order. True if any of the calls returned true
+    bool run(const std::function<bool(const Tile&)>& kernel) const;
+
+private:
+    uint32_t width;
+    uint32_t height;
+    PixelView_3x3::ScanOrder order;
+    uint32_t tile_width;
+    uint32_t cols;
+    uint32_t rows;
+};
+
+// DirtyRows for repeating passes over a TileGrid, every column of tiles
+// has its own dirty rows. A change dirties the rows next to it in the
+// columns it can reach too, several tiles can do that at once
+struct DirtyTileRows
+{
+    uint32_t n_cols;
+    // row `r` of column `c` is at `(r + 1) * n_cols + c`
+    std::unique_ptr<std::atomic<uint8_t>[]> dirty;
+
+    // all the rows are dirty to begin with
+    DirtyTileRows(uint32_t height, uint32_t n_cols);
+
+    // true if row `r` of column `col` has to be visited, it's clean
+    // afterwards
+    inline bool visit(uint32_t r, uint32_t col)
+    {
+        return dirty[(r + 1) * (size_t)n_cols + col].exchange(0,
+            std::memory_order_relaxed);
+    }
+
+    // Row `r` of column `col` changed, `next` is the row after it in the
+    // scan. The neighbours of a pixel in the row before it are in this
+    // column or the one before, those in the row after it in this column
+    // or the one after
+    inline void changed(uint32_t r, uint32_t col, uint32_t next)
+    {
+        uint32_t prev = 2 * r - next;
+        mark(prev, col);
+        mark(r, col);
+        mark(next, col);
+        if (col)
+        {
+            mark(prev, col - 1);
+            mark(r, col - 1);
+        }
+        if (col + 1 < n_cols)
+        {
+            mark(r, col + 1);
+            mark(next, col + 1);
+        }
+    }
+
+private:
+    inline void mark(uint32_t r, uint32_t col)
+    {
+        dirty[(r + 1) * (size_t)n_cols + col].store(1,
+            std::memory_order_relaxed);
+    }
+};
+
+#endif // TILE_GRID_H
@@ -0,0 +1,207 @@
+#include "depth_convert.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// 4x4 Bayer matrix
+static constexpr uint8_t BAYER[4][4] =
+{
+    { 0,  8,  2, 10},
+    {12,  4, 14,  6},
+    { 3, 11,  1,  9},
+    {15,  7, 13,  5}
+};
+
+static inline uint16_t load_be16(const uint8_t* p)
+{
+    return p[0] << 8 | p[1];
+}
+
+static inline float load_be_float(const uint8_t* p)
+{
+    uint32_t bits = (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+    float value;
+    memcpy(&value, &bits, 4);
+    return value;
+}
+
+// offsets added before dropping the low 8 bits of a value already scaled
+// by 255 / 256, [0, 255]
+static inline uint16_t dither_offset_16(uint64_t x, uint64_t y)
+{
+    return BAYER[y & 3][x & 3] * 16 + 8;
+}
+
+static inline float dither_offset_32(uint64_t x, uint64_t y)
+{
+    return (BAYER[y & 3][x & 3] + 0.5f) / 16;
+}
+
+// exact round(v / 257) is (v * 255 + 32895) >> 16, this form of it fits into
+// 16 bits as long as the first addition saturates
+static inline uint8_t narrow_16(uint16_t v, DepthConversion mode, uint64_t x,
+    uint64_t y)
+{
+    switch (mode)
+    {
+    case DEPTH_ROUND:
+    {
+        uint16_t t = std::min(v + 128, 0xFFFF);
+        return (t - (t >> 8)) >> 8;
+    }
+    case DEPTH_DITHER:
+        return (v - (v >> 8) + dither_offset_16(x, y)) >> 8;
+    default:
+        return v >> 8;
+    }
+}
+
+static inline uint8_t narrow_32(float v, DepthConversion mode, uint64_t x,
+    uint64_t y)
+{
+    // written so that NaN ends up as 0
+    v = v > 0 ? std::min(v, 1.0f) : 0;
+
+    switch (mode)
+    {
+    case DEPTH_ROUND:
+        return v * 255 + 0.5f;
+    case DEPTH_DITHER:
+        return std::min(v * 255 + dither_offset_32(x, y), 255.0f);
+    default:
+        return v * 255;
+    }
+}
+
+#ifdef __SSE2__
+
+// 16 values per iteration, returns how many were done
+static uint64_t narrow_16_sse2(const uint8_t* src, uint8_t* dst,
+    uint64_t width, uint64_t row, DepthConversion mode)
+{
+    // x is always a multiple of 16 here, so every vector starts the pattern
+    const __m128i dither = _mm_setr_epi16(
+        dither_offset_16(0, row), dither_offset_16(1, row),
+        dither_offset_16(2, row), dither_offset_16(3, row),
+        dither_offset_16(4, row), dither_offset_16(5, row),
+        dither_offset_16(6, row), dither_offset_16(7, row));
+    const __m128i half = _mm_set1_epi16(128);
+
+    uint64_t x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        __m128i v[2];
+        for (int i = 0; i < 2; ++i)
+        {
+            __m128i be = _mm_loadu_si128((const __m128i*)(src + x * 2 + i * 16));
+            // big endian to native
+            v[i] = _mm_or_si128(_mm_slli_epi16(be, 8), _mm_srli_epi16(be, 8));
+
+            switch (mode)
+            {
+            case DEPTH_ROUND:
+            {
+                __m128i t = _mm_adds_epu16(v[i], half);
+                v[i] = _mm_srli_epi16(
+                    _mm_sub_epi16(t, _mm_srli_epi16(t, 8)), 8);
+            }
+                break;
+            case DEPTH_DITHER:
+                v[i] = _mm_srli_epi16(_mm_add_epi16(
+                    _mm_sub_epi16(v[i], _mm_srli_epi16(v[i], 8)), dither), 8);
+                break;
+            default:
+                v[i] = _mm_srli_epi16(v[i], 8);
+                break;
+            }
+        }
+
+        _mm_storeu_si128((__m128i*)(dst + x), _mm_packus_epi16(v[0], v[1]));
+    }
+
+    return x;
+}
+
+static inline __m128i byteswap_32(__m128i v)
+{
+    const __m128i mid = _mm_set1_epi32(0x00FF0000);
+    return _mm_or_si128(
+        _mm_or_si128(_mm_slli_epi32(v, 24), _mm_srli_epi32(v, 24)),
+        _mm_or_si128(_mm_and_si128(_mm_slli_epi32(v, 8), mid),
+            _mm_srli_epi32(_mm_and_si128(v, mid), 8)));
+}
+
+// 16 values per iteration, returns how many were done
+static uint64_t narrow_32_sse2(const uint8_t* src, uint8_t* dst,
+    uint64_t width, uint64_t row, DepthConversion mode)
+{
+    __m128 offset;
+    switch (mode)
+    {
+    case DEPTH_ROUND:
+        offset = _mm_set1_ps(0.5f);
+        break;
+    case DEPTH_DITHER:
+        offset = _mm_setr_ps(dither_offset_32(0, row),
+            dither_offset_32(1, row), dither_offset_32(2, row),
+            dither_offset_32(3, row));
+        break;
+    default:
+        offset = _mm_setzero_ps();
+        break;
+    }
+
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 scale = _mm_set1_ps(255.0f);
+    const __m128 max = _mm_set1_ps(255.0f);
+
+    uint64_t x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        __m128i v[4];
+        for (int i = 0; i < 4; ++i)
+        {
+            __m128i be = _mm_loadu_si128((const __m128i*)(src + x * 4 + i * 16));
+            __m128 f = _mm_castsi128_ps(byteswap_32(be));
+            // max returns its second operand for NaN
+            f = _mm_min_ps(_mm_max_ps(f, zero), one);
+            f = _mm_min_ps(_mm_add_ps(_mm_mul_ps(f, scale), offset), max);
+            v[i] = _mm_cvttps_epi32(f);
+        }
+
+        _mm_storeu_si128((__m128i*)(dst + x), _mm_packus_epi16(
+            _mm_packs_epi32(v[0], v[1]), _mm_packs_epi32(v[2], v[3])));
+    }
+
+    return x;
+}
+
+#endif
+
+void narrow_row(const uint8_t* src, uint8_t* dst, uint64_t width,
+    uint16_t depth, uint64_t row, DepthConversion mode)
+{
+    uint64_t x = 0;
+
+    if (depth == 16)
+    {
+#ifdef __SSE2__
+        x = narrow_16_sse2(src, dst, width, row, mode);
+#endif
+        for (; x < width; ++x)
+            dst[x] = narrow_16(load_be16(src + x * 2), mode, x, row);
+    }
+    else if (depth == 32)
+    {
+#ifdef __SSE2__
+        x = narrow_32_sse2(src, dst, width, row, mode);
+#endif
+        for (; x < width; ++x)
+            dst[x] = narrow_32(load_be_float(src + x * 4), mode, x, row);
+    }
+}
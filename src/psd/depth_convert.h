@@ -0,0 +1,21 @@
+#ifndef DEPTH_CONVERT_H
+#define DEPTH_CONVERT_H
+
+#include <cstdint>
+
+// How 16 and 32 bit channels are brought down to the 8 bit working format
+enum DepthConversion : uint8_t
+{
+    DEPTH_TRUNCATE,     // drops the low bits
+    DEPTH_ROUND,        // nearest 8 bit value
+    DEPTH_DITHER        // 4x4 ordered dithering, keeps smooth gradients smooth
+};
+
+// Narrows a row of `width` big endian values of `depth` bits (16 or 32) into
+// 8 bit values. `row` only picks the dithering pattern.
+// 16 bit values are scaled by 255 / 65535, 32 bit ones are floats where
+// [0, 1] is mapped to [0, 255] without any gamma correction
+void narrow_row(const uint8_t* src, uint8_t* dst, uint64_t width,
+    uint16_t depth, uint64_t row, DepthConversion mode);
+
+#endif // DEPTH_CONVERT_H
@@ -0,0 +1,141 @@
+#include "mapped_file.h"
+
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(const char* filepath)
+{
+    close();
+
+    HANDLE file = CreateFileA(filepath, GENERIC_READ, FILE_SHARE_READ, nullptr,
+        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0,
+        nullptr);
+    if (!mapping)
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!view)
+    {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    file_handle = file;
+    mapping_handle = mapping;
+    bytes = static_cast<const uint8_t*>(view);
+    length = file_size.QuadPart;
+
+    return true;
+}
+
+void MappedFile::discard(uint64_t, uint64_t) const
+{
+    // the system trims mapped views on its own
+}
+
+void MappedFile::close()
+{
+    if (bytes)
+        UnmapViewOfFile(bytes);
+    if (mapping_handle)
+        CloseHandle(mapping_handle);
+    if (file_handle)
+        CloseHandle(file_handle);
+
+    bytes = nullptr;
+    length = 0;
+    mapping_handle = file_handle = nullptr;
+}
+
+#else
+
+bool MappedFile::open(const char* filepath)
+{
+    close();
+
+    int file = ::open(filepath, O_RDONLY);
+    if (file < 0)
+        return false;
+
+    struct stat st;
+    // mapping an empty file fails, and there is nothing to read in it anyway
+    if (fstat(file, &st) || st.st_size <= 0)
+    {
+        ::close(file);
+        return false;
+    }
+
+    void* view = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    if (view == MAP_FAILED)
+    {
+        ::close(file);
+        return false;
+    }
+    // the whole file is read front to back once
+    madvise(view, st.st_size, MADV_SEQUENTIAL);
+
+    fd = file;
+    bytes = static_cast<const uint8_t*>(view);
+    length = st.st_size;
+
+    return true;
+}
+
+void MappedFile::discard(uint64_t offset, uint64_t count) const
+{
+    if (offset >= length)
+        return;
+    count = std::min(count, length - offset);
+
+    // only whole pages inside the range can be dropped
+    uint64_t page = sysconf(_SC_PAGESIZE);
+    uint64_t from = (offset + page - 1) / page * page;
+    uint64_t to = (offset + count) / page * page;
+
+    if (from < to)
+        madvise(const_cast<uint8_t*>(bytes) + from, to - from, MADV_DONTNEED);
+}
+
+void MappedFile::close()
+{
+    if (bytes)
+        munmap(const_cast<uint8_t*>(bytes), length);
+    if (fd >= 0)
+        ::close(fd);
+
+    bytes = nullptr;
+    length = 0;
+    fd = -1;
+}
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstdint>
+#include <cstring>
+
+// Read-only memory mapping of a whole file. Section readers work directly on
+// the mapped bytes, so decoding doesn't go through a libc call per byte
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const char* filepath);
+    void close();
+
+    inline const uint8_t* data() const
+    {
+        return bytes;
+    }
+
+    inline uint64_t size() const
+    {
+        return length;
+    }
+
+    // Hints that [offset, offset + count) won't be read again, so its pages
+    // can be dropped from memory right away
+    void discard(uint64_t offset, uint64_t count) const;
+
+private:
+    const uint8_t* bytes = nullptr;
+    uint64_t length = 0;
+
+#ifdef _WIN32
+    void* file_handle = nullptr;
+    void* mapping_handle = nullptr;
+#else
+    int fd = -1;
+#endif
+};
+
+// Sequential reader over a byte range. Every access is checked against the
+// end of the range, reading past it fails instead of touching unmapped memory
+struct ByteCursor
+{
+    const uint8_t* data = nullptr;
+    uint64_t size = 0;
+    uint64_t pos = 0;
+
+    ByteCursor() = default;
+    ByteCursor(const uint8_t* data, uint64_t size)
+        : data(data), size(size), pos(0)
+    {}
+
+    inline uint64_t remaining() const
+    {
+        return size - pos;
+    }
+
+    inline bool read(void* dst, uint64_t count)
+    {
+        if (count > remaining())
+            return false;
+
+        memcpy(dst, data + pos, count);
+        pos += count;
+        return true;
+    }
+
+    inline bool skip(uint64_t count)
+    {
+        if (count > remaining())
+            return false;
+
+        pos += count;
+        return true;
+    }
+
+    // returns a pointer to the next `count` bytes and moves past them,
+    // nullptr if there isn't enough data left
+    inline const uint8_t* take(uint64_t count)
+    {
+        if (count > remaining())
+            return nullptr;
+
+        const uint8_t* p = data + pos;
+        pos += count;
+        return p;
+    }
+};
+
+#endif // MAPPED_FILE_H
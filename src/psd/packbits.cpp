@@ -0,0 +1,85 @@
+#include "packbits.h"
+
+#include <cstring>
+
+bool unpack_bits(ByteCursor& src, uint8_t* dst, uint64_t dst_len)
+{
+    uint8_t* p = dst;
+    uint8_t* end = dst + dst_len;
+
+    while (p < end)
+    {
+        if (!src.remaining())
+            return false;
+        // not converting to big endian because it's only 1 byte long
+        int length = (int8_t)src.data[src.pos++];
+
+        if (length == -128)
+            continue;
+        if (length >= 0)
+        {
+            ++length;
+
+            const uint8_t* literal = src.take(length);
+            if (!literal || length > end - p)
+                return false;
+
+            memcpy(p, literal, length);
+        }
+        else
+        {
+            length = 1 - length;
+
+            if (!src.remaining() || length > end - p)
+                return false;
+
+            memset(p, src.data[src.pos++], length);
+        }
+        p += length;
+    }
+
+    return true;
+}
+
+size_t pack_bits(const uint8_t* src, size_t len, uint8_t* dst)
+{
+    uint8_t* p = dst;
+    size_t i = 0;
+
+    while (i < len)
+    {
+        // count amount of the same consecutive values
+        size_t run_length = 1;
+        while (i + run_length < len && run_length < 128 &&
+            src[i + run_length] == src[i])
+            ++run_length;
+
+        // a run of 2 costs as much as a literal, and splitting a literal
+        // around it would cost more, so only longer runs are repeated.
+        // This keeps the output within `len + ceil(len / 128)` bytes
+        if (run_length > 2)
+        {
+            // repeat `src[i]` `run_length` times
+            *p++ = (uint8_t)(int8_t)(1 - (int)run_length);
+            *p++ = src[i];
+            i += run_length;
+            continue;
+        }
+
+        // count amount of values up to the next run of 3 or more
+        size_t start = i;
+        run_length = 0;
+        while (i < len && run_length < 128 &&
+            !(i + 2 < len && src[i] == src[i + 1] && src[i] == src[i + 2]))
+        {
+            ++i;
+            ++run_length;
+        }
+        // write `run_length` unique values
+        *p++ = (uint8_t)(run_length - 1);
+        memcpy(p, src + start, run_length);
+        p += run_length;
+    }
+
+    return p - dst;
+}
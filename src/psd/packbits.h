@@ -0,0 +1,19 @@
+#ifndef PACKBITS_H
+#define PACKBITS_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mapped_file.h"
+
+// PSD uses PackBits implementation of RLE
+// http://fileformats.archiveteam.org/wiki/PackBits
+
+// decodes exactly `dst_len` bytes, fails on truncated or overflowing data
+bool unpack_bits(ByteCursor& src, uint8_t* dst, uint64_t dst_len);
+
+// encoding of a single row, returns the amount of bytes written.
+// `dst` has to fit the worst case of `len + (len + 127) / 128` bytes
+size_t pack_bits(const uint8_t* src, size_t len, uint8_t* dst);
+
+#endif // PACKBITS_H
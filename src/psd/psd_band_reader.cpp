@@ -0,0 +1,75 @@
+#include "psd_band_reader.h"
+
+bool PsdBandReader::open(const char* filepath, uint32_t band_rows,
+    const std::vector<uint16_t>& channels)
+{
+    corrupted = false;
+    band_start = next_row = 0;
+
+    if (!band_rows || !file.open(filepath))
+        return false;
+
+    ByteCursor cursor(file.data(), file.size());
+
+    // everything up to the pixel data is read the same way as by PsdManager
+    if (!PsdManager::read_file_header(cursor, header) ||
+        !PsdManager::read_color_mode_data(cursor, header) ||
+        !PsdManager::read_image_resources(cursor, header) ||
+        !PsdManager::read_layer_and_mask_info(cursor, header) ||
+        !PsdManager::read_image_data_header(cursor, header, row_offsets) ||
+        // a ZIP stream can't be split into bands
+        header.compression == PsdData::PSD_COMPR_ZIP_NO_PREDICT ||
+        header.compression == PsdData::PSD_COMPR_ZIP_PREDICT)
+    {
+        file.close();
+        return false;
+    }
+
+    this->band_rows = band_rows;
+    this->channels = channels;
+
+    if (this->channels.empty())
+        for (uint16_t i = 0; i < header.n_channels; ++i)
+            this->channels.push_back(i);
+
+    for (uint16_t channel : this->channels)
+        if (channel >= header.n_channels)
+        {
+            file.close();
+            return false;
+        }
+
+    return true;
+}
+
+bool PsdBandReader::next(ImageData& band)
+{
+    if (corrupted || !file.data() || next_row >= header.height)
+        return false;
+
+    uint32_t n_rows = std::min(band_rows, header.height - next_row);
+
+    // every pixel gets overwritten by the decoder
+    band.allocate(channels.size(), n_rows, header.width);
+
+    ByteCursor cursor(file.data(), file.size());
+    if (!PsdManager::decode_rows(cursor, header, row_offsets, channels,
+        next_row, n_rows, band))
+    {
+        corrupted = true;
+        return false;
+    }
+
+    // decoded rows of every channel won't be needed anymore
+    for (uint16_t channel : channels)
+    {
+        uint64_t first = (uint64_t)channel * header.height + next_row;
+        file.discard(row_offsets[first],
+            row_offsets[first + n_rows] - row_offsets[first]);
+    }
+
+    band_start = next_row;
+    next_row += n_rows;
+
+    return true;
+}
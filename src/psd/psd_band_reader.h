@@ -0,0 +1,61 @@
+#ifndef PSD_BAND_READER_H
+#define PSD_BAND_READER_H
+
+#include <vector>
+
+#include "psd_manager.h"
+
+// Decodes a PSD file as horizontal bands of rows, for images that don't fit
+// in memory as a whole. Only the current band is kept decoded, the mapped
+// file pages are dropped as soon as the band they belong to is decoded.
+// Only RAW and RLE data can be split into bands, ZIP files fail to open.
+//
+//  PsdBandReader reader;
+//  ImageData band;
+//  if (reader.open(path, 256))
+//      while (reader.next(band))
+//          grayscale.process(band);
+class PsdBandReader
+{
+public:
+    PsdBandReader() = default;
+    virtual ~PsdBandReader() = default;
+
+    // `channels` selects which channels end up in the bands and in what order,
+    // all of them when empty
+    bool open(const char* filepath, uint32_t band_rows,
+        const std::vector<uint16_t>& channels = {});
+
+    // Decodes the next band into `band`, reusing its memory.
+    // Returns false after the last band or if the data is corrupted
+    bool next(ImageData& band);
+
+    // header data of the whole image, without pixel data
+    inline const PsdData& get_header() const
+    {
+        return header;
+    }
+
+    // first row of the band returned by the last `next` call
+    inline uint32_t get_band_start() const
+    {
+        return band_start;
+    }
+
+    inline bool failed() const
+    {
+        return corrupted;
+    }
+
+private:
+    MappedFile file;
+    PsdData header;
+    std::vector<uint16_t> channels;
+    std::vector<uint64_t> row_offsets;
+    uint32_t band_rows = 0;
+    uint32_t band_start = 0;
+    uint32_t next_row = 0;
+    bool corrupted = false;
+};
+
+#endif // PSD_BAND_READER_H
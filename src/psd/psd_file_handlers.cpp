@@ -2,10 +2,18 @@
 
 #include <array>
 #include <algorithm>
+#include <atomic>
 #include <bit>
 #include <cstring>
 
+#include "../processing/common_processors.h"
+#include "../processing/thread_pool.h"
+#include "depth_convert.h"
+#include "packbits.h"
+#include "zip_codec.h"
+
 #define SIGN_8BPS (1397768760) // ASCII string "8BPS"
+#define SIGN_8BIM (1296646712) // ASCII string "8BIM"
 
 // making my own because i'm having problems with building the app with c++23 standard
 template<class T>
@@ -26,46 +34,51 @@ static void confirm_endianness(T& value)
     byteswap(value);
 }
 
-bool PsdManager::read_file_header(FILE* file, PsdData& image)
+bool PsdManager::read_file_header(ByteCursor& file, PsdData& image)
 {   // read img size and skip the rest
     uint32_t signature = 0;
-    int16_t version = 0;
 
     // 4 byte signature
-    if (!fread(&signature, 4, 1, file))
+    if (!file.read(&signature, 4))
         return false;
     if (signature != SIGN_8BPS)
         return false;
-    // 2 byte version
-    if (!fread(&version, 2, 1, file))
+    // 2 byte version, 1 for PSD and 2 for PSB
+    if (!file.read(&image.version, 2))
         return false;
-    confirm_endianness(version);
-    if (version != 1)
+    confirm_endianness(image.version);
+    if (image.version != PsdData::VERSION_PSD &&
+        image.version != PsdData::VERSION_PSB)
         return false;
     // 6 bytes reserved
-    if (fseek(file, 6, SEEK_CUR))
+    if (!file.skip(6))
         return false;
     // 2 byte number of chanels
-    if (!fread(&image.n_channels, 2, 1, file))
+    if (!file.read(&image.n_channels, 2))
         return false;
     confirm_endianness(image.n_channels);
     // 4 byte height
-    if (!fread(&image.height, 4, 1, file))
+    if (!file.read(&image.height, 4))
         return false;
     confirm_endianness(image.height);
     // 4 byte width
-    if (!fread(&image.width, 4, 1, file))
+    if (!file.read(&image.width, 4))
         return false;
     confirm_endianness(image.width);
+    uint32_t max_size = image.version == PsdData::VERSION_PSB ?
+        PsdData::PSB_MAX_SIZE : PsdData::PSD_MAX_SIZE;
+    if (!image.width || !image.height ||
+        image.width > max_size || image.height > max_size)
+        return false;
     // 2 byte depth
-    if (!fread(&image.depth, 2, 1, file))
+    if (!file.read(&image.depth, 2))
         return false;
     confirm_endianness(image.depth);
-    // the task only requires 32 bpp, which is 8 bits per channel
-    if (image.depth != 8)
+    // higher depths are narrowed to 8 bits per channel while decoding
+    if (image.depth != 8 && image.depth != 16 && image.depth != 32)
         return false;
     // 2 byte color mode,
-    if (!fread(&image.color_mode, 2, 1, file))
+    if (!file.read(&image.color_mode, 2))
         return false;
     confirm_endianness(image.color_mode);
     // only Grayscale and RGB are supported
@@ -75,144 +88,435 @@ bool PsdManager::read_file_header(FILE* file, PsdData& image)
     return true;
 }
 
-bool PsdManager::read_color_mode_data(FILE* file, PsdData& image)
-{   // skip
-    // 4 bytes color data length
+// color mode data, image resources and layer and mask info sections
+// all start with their 4 byte length
+static bool skip_section(ByteCursor& file)
+{
     uint32_t len = 0;
-    if (!fread(&len, 4, 1, file))
+    if (!file.read(&len, 4))
         return false;
     confirm_endianness(len);
     // skip the rest
-    if (fseek(file, len, SEEK_CUR))
-        return false;
+    return file.skip(len);
+}
 
-    return true;
+bool PsdManager::read_color_mode_data(ByteCursor& file, PsdData&)
+{   // skip
+    return skip_section(file);
 }
 
-bool PsdManager::read_image_resources(FILE* file, PsdData& image)
+bool PsdManager::read_image_resources(ByteCursor& file, PsdData&)
 {   // skip
+    return skip_section(file);
+}
+
+// image resource block IDs
+#define RESOURCE_THUMBNAIL_PS4 (1033)
+#define RESOURCE_THUMBNAIL (1036)
+#define THUMBNAIL_FORMAT_JPEG (1)
+
+// finds the thumbnail resource and copies its JPEG data
+static bool read_thumbnail_resource(ByteCursor& file, PsdThumbnail& thumbnail)
+{
     // 4 bytes resource section length
     uint32_t len = 0;
-    if (!fread(&len, 4, 1, file))
+    if (!file.read(&len, 4))
         return false;
     confirm_endianness(len);
-    // skip the rest
-    if (fseek(file, len, SEEK_CUR))
+
+    const uint8_t* section = file.take(len);
+    if (!section)
         return false;
+    ByteCursor resources(section, len);
 
-    return true;
+    while (resources.remaining())
+    {
+        // 4 byte signature, 2 byte ID
+        uint32_t signature = 0;
+        uint16_t id = 0;
+        if (!resources.read(&signature, 4) || signature != SIGN_8BIM ||
+            !resources.read(&id, 2))
+            return false;
+        confirm_endianness(id);
+        // pascal string name, padded to make the size even
+        uint8_t name_len = 0;
+        if (!resources.read(&name_len, 1) || !resources.skip(name_len | 1))
+            return false;
+        // 4 byte data size, data is padded to make the size even
+        uint32_t size = 0;
+        if (!resources.read(&size, 4))
+            return false;
+        confirm_endianness(size);
+
+        const uint8_t* data = resources.take(size);
+        if (!data)
+            return false;
+        resources.skip(size & 1);
+
+        if (id != RESOURCE_THUMBNAIL && id != RESOURCE_THUMBNAIL_PS4)
+            continue;
+
+        // 4 byte format, 4 byte width, 4 byte height, 4 byte row size,
+        // 4 byte total size, 4 byte compressed size, 2 byte bits per pixel,
+        // 2 byte planes count, followed by the JFIF data
+        ByteCursor header(data, size);
+        uint32_t format = 0;
+        if (!header.read(&format, 4))
+            return false;
+        confirm_endianness(format);
+        if (format != THUMBNAIL_FORMAT_JPEG)
+            return false;
+
+        if (!header.read(&thumbnail.width, 4) ||
+            !header.read(&thumbnail.height, 4) || !header.skip(16))
+            return false;
+        confirm_endianness(thumbnail.width);
+        confirm_endianness(thumbnail.height);
+
+        thumbnail.bgr = id == RESOURCE_THUMBNAIL_PS4;
+        thumbnail.jpeg.assign(header.data + header.pos, header.data + size);
+
+        return true;
+    }
+
+    return false;
 }
 
-bool PsdManager::read_layer_and_mask_info(FILE* file, PsdData& image)
+bool PsdManager::read_thumbnail(const char* filepath, PsdThumbnail& thumbnail)
+{
+    MappedFile file;
+    if (!file.open(filepath))
+        return false;
+
+    ByteCursor cursor(file.data(), file.size());
+    PsdData header;
+
+    return read_file_header(cursor, header) &&
+        read_color_mode_data(cursor, header) &&
+        read_thumbnail_resource(cursor, thumbnail);
+}
+
+bool PsdManager::read_layer_and_mask_info(ByteCursor& file, PsdData& image)
 {   // skip
-    // 4 bytes layer and mask info length
-    uint32_t len = 0;
-    if (!fread(&len, 4, 1, file))
+    if (image.version != PsdData::VERSION_PSB)
+        return skip_section(file);
+
+    // PSB has 8 bytes of length here
+    uint64_t len = 0;
+    if (!file.read(&len, 8))
         return false;
     confirm_endianness(len);
-    // skip the rest
-    if (fseek(file, len, SEEK_CUR))
-        return false;
-
-    return true;
+    return file.skip(len);
 }
 
-bool PsdManager::read_image_data(FILE* file, PsdData& image)
+bool PsdManager::read_image_data_header(ByteCursor& file, PsdData& image,
+    std::vector<uint64_t>& row_offsets)
 {
     // 2 byte compression method
-    if (!fread(&image.compression, 2, 1, file))
+    if (!file.read(&image.compression, 2))
         return false;
     confirm_endianness(image.compression);
 
-    // image data
+    uint64_t n_rows = (uint64_t)image.height * image.n_channels;
+    uint64_t bytes_per_row = (uint64_t)image.depth / 8 * image.width;
+
     switch (image.compression)
     {
-    // only RLE compression is supported
-    // PSD uses PackBits implementation of RLE
-    // http://fileformats.archiveteam.org/wiki/PackBits
+    case PsdData::PSD_COMPR_RAW:
+        // rows of all channels follow each other uncompressed
+        row_offsets.resize(n_rows + 1);
+        for (uint64_t i = 0; i <= n_rows; ++i)
+            row_offsets[i] = file.pos + i * bytes_per_row;
+        break;
     case PsdData::PSD_COMPR_RLE:
     {
-        uint32_t width = image.width;
-        uint32_t height = image.height;
-        uint64_t num_pixels = width * height;
-        uint16_t bytes_per_color = image.depth / 8;
-        uint64_t bytes_per_channel = bytes_per_color * num_pixels;
-
-        image.channels_data.assign(image.n_channels, {});
-
-        uint64_t read_bytes = 0;
-        int8_t byte_buf = 0;
-
         // PSD RLE implementation adds data counts per each row per each channel
-        // this includes both RLE markers and the data itself
-        // skip
-        if (fseek(file, height * image.n_channels * 2, SEEK_CUR))
+        // this includes both RLE markers and the data itself.
+        // Their prefix sums give where every row starts, so rows don't depend
+        // on each other and can be decoded in parallel.
+        // Counts are 2 bytes long in PSD and 4 bytes long in PSB
+        bool psb = image.version == PsdData::VERSION_PSB;
+        const uint8_t* counts = file.take(n_rows * (psb ? 4 : 2));
+        if (!counts)
             return false;
 
-        for (std::vector<uint8_t>& channel : image.channels_data)
+        row_offsets.resize(n_rows + 1);
+        row_offsets[0] = file.pos;
+        for (uint64_t i = 0; i < n_rows; ++i)
         {
-            channel.assign(bytes_per_channel, 0);
-            auto p = channel.data();
+            uint32_t count = 0;
+            if (psb)
+            {
+                memcpy(&count, counts + i * 4, 4);
+                confirm_endianness(count);
+            }
+            else
+            {
+                uint16_t short_count = 0;
+                memcpy(&short_count, counts + i * 2, 2);
+                confirm_endianness(short_count);
+                count = short_count;
+            }
+            row_offsets[i + 1] = row_offsets[i] + count;
+        }
+        break;
+    }
+    case PsdData::PSD_COMPR_ZIP_NO_PREDICT: // fallthrough
+    case PsdData::PSD_COMPR_ZIP_PREDICT:
+        // one zlib stream till the end of the file, rows can't be located
+        // without inflating everything before them
+        row_offsets.assign({file.pos, file.size});
+        return true;
+    default:
+        return false;
+    }
 
-            read_bytes = 0;
+    return row_offsets.back() <= file.size;
+}
+
+// rows per parallel decoding task
+static constexpr size_t DECODE_GRAIN = 64;
+
+bool PsdManager::decode_rows(const ByteCursor& file, const PsdData& image,
+    const std::vector<uint64_t>& row_offsets,
+    const std::vector<uint16_t>& channels, uint32_t first_row,
+    uint32_t n_rows, ImageData& planes)
+{
+    uint64_t width = image.width;
+    uint64_t bytes_per_row = (uint64_t)image.depth / 8 * width;
+    bool raw = image.compression == PsdData::PSD_COMPR_RAW;
+    bool narrow = image.depth != 8;
+    std::atomic<bool> corrupted = false;
+
+    ThreadPool::global().parallel_for(0, (uint64_t)channels.size() * n_rows,
+        DECODE_GRAIN, [&](size_t from, size_t to)
+        {
+            // rows deeper than 8 bits are unpacked here, then narrowed
+            std::vector<uint8_t> wide_row(narrow && !raw ? bytes_per_row : 0);
 
-            while (read_bytes < num_pixels)
+            for (size_t i = from; i < to && !corrupted; ++i)
             {
-                // not converting to big endian because it's only 1 byte long
-                // could be a problem if >8 bits per color are used
-                if (!fread(&byte_buf, 1, 1, file))
-                    return false;
+                size_t channel = i / n_rows;
+                size_t row = i % n_rows;
+                // rows in the file are stored channel after channel
+                size_t file_row = (size_t)channels[channel] * image.height +
+                    first_row + row;
 
-                short length = byte_buf;
+                uint8_t* dst = planes.row(channel, row);
+                ByteCursor src(file.data + row_offsets[file_row],
+                    row_offsets[file_row + 1] - row_offsets[file_row]);
 
-                if (length == -128)
-                    continue;
-                if (length >= 0)
+                if (raw)
                 {
-                    ++length;
+                    if (narrow)
+                        narrow_row(src.data, dst, width, image.depth,
+                            first_row + row, image.depth_conversion);
+                    else
+                        memcpy(dst, src.data, bytes_per_row);
+                    continue;
+                }
 
-                    if (!fread(p, 1, length, file))
-                        return false;
+                // a row has to decode to exactly its width, otherwise it
+                // would shift all the following ones
+                if (!unpack_bits(src, narrow ? wide_row.data() : dst,
+                    bytes_per_row))
+                    corrupted = true;
+                else if (narrow)
+                    narrow_row(wide_row.data(), dst, width, image.depth,
+                        first_row + row, image.depth_conversion);
+            }
+        });
 
-                    p += length;
-                    read_bytes += length;
-                }
+    return !corrupted;
+}
+
+bool PsdManager::read_image_data(ByteCursor& file, PsdData& image)
+{
+    std::vector<uint64_t> row_offsets;
+    if (!read_image_data_header(file, image, row_offsets))
+        return false;
+
+    if (image.decode_grayscale)
+        return read_grayscale_data(file, image, row_offsets);
+
+    std::vector<uint16_t> channels(image.n_channels);
+    for (uint16_t i = 0; i < image.n_channels; ++i)
+        channels[i] = i;
+
+    // decoded channels are always 8 bits, every pixel gets overwritten by
+    // the decoder
+    image.image.allocate(image.n_channels, image.height, image.width);
+
+    switch (image.compression)
+    {
+    case PsdData::PSD_COMPR_RAW: // fallthrough
+    case PsdData::PSD_COMPR_RLE:
+        if (!decode_rows(file, image, row_offsets, channels, 0, image.height,
+            image.image))
+            return false;
+
+        file.pos = row_offsets.back();
+        break;
+    case PsdData::PSD_COMPR_ZIP_NO_PREDICT: // fallthrough
+    case PsdData::PSD_COMPR_ZIP_PREDICT:
+    {
+        uint64_t width = image.width;
+        uint64_t bytes_per_row = (uint64_t)image.depth / 8 * width;
+        bool predict = image.compression == PsdData::PSD_COMPR_ZIP_PREDICT;
+        std::vector<uint8_t> scratch(bytes_per_row);
+
+        if (!inflate_rows(file, bytes_per_row,
+            (uint64_t)image.height * image.n_channels,
+            [&](uint64_t i, uint8_t* row)
+            {
+                uint64_t r = i % image.height;
+                uint8_t* dst = image.image.row(i / image.height, r);
+
+                if (predict)
+                    unpredict_row(row, width, image.depth, scratch.data());
+
+                if (image.depth == 8)
+                    memcpy(dst, row, width);
                 else
-                {
-                    length = 1 - length;
+                    narrow_row(row, dst, width, image.depth, r,
+                        image.depth_conversion);
+            }))
+            return false;
+        break;
+    }
+    default:
+        return false;
+    }
 
-                    if (!fread(&byte_buf, 1, 1, file))
-                        return false;
-                    memset(p, byte_buf, length);
-                    p += length;
+    image.depth = 8;
 
-                    read_bytes += length;
-                }
-            }
+    return true;
+}
+
+bool PsdManager::read_grayscale_data(ByteCursor& file, PsdData& image,
+    const std::vector<uint64_t>& row_offsets)
+{
+    uint64_t width = image.width;
+    // less than 3 channels can't be grayscaled, the first one is kept as is
+    bool rgb = image.n_channels >= 3;
+
+    ImageData& gray = image.image;
+    gray.allocate(1, image.height, image.width);
+
+    switch (image.compression)
+    {
+    case PsdData::PSD_COMPR_RAW: // fallthrough
+    case PsdData::PSD_COMPR_RLE:
+    {
+        if (!rgb)
+        {
+            if (!decode_rows(file, image, row_offsets, {0}, 0, image.height,
+                gray))
+                return false;
+            break;
         }
+
+        // R, G and B of a band of rows are decoded into small planes and
+        // turned into luminance right away, while they are still in cache
+        std::atomic<bool> corrupted = false;
+        ThreadPool::global().parallel_for(0, image.height, DECODE_GRAIN,
+            [&](size_t from, size_t to)
+            {
+                uint32_t n_rows = to - from;
+                ImageData planes;
+                planes.allocate(3, n_rows, image.width);
+
+                if (corrupted || !decode_rows(file, image, row_offsets,
+                    {0, 1, 2}, from, n_rows, planes))
+                {
+                    corrupted = true;
+                    return;
+                }
+
+                // same stride, so the band is converted in one go
+                Grayscale::convert_row(planes.plane(0), planes.plane(1),
+                    planes.plane(2), gray.row(0, from), planes.plane_size());
+            });
+        if (corrupted)
+            return false;
+        break;
+    }
+    case PsdData::PSD_COMPR_ZIP_NO_PREDICT: // fallthrough
+    case PsdData::PSD_COMPR_ZIP_PREDICT:
+    {
+        // channels come one after another in a single stream, so R has to
+        // be kept until B arrives. R goes straight into the gray plane
+        uint64_t bytes_per_row = (uint64_t)image.depth / 8 * width;
+        bool predict = image.compression == PsdData::PSD_COMPR_ZIP_PREDICT;
+        std::vector<uint8_t> scratch(bytes_per_row);
+        ImageData green;
+        if (rgb)
+            green.allocate(1, image.height, width);
+        std::vector<uint8_t> blue(rgb ? width : 0);
+
+        // the stream isn't inflated past the last used channel
+        if (!inflate_rows(file, bytes_per_row,
+            (uint64_t)image.height * (rgb ? 3 : 1),
+            [&](uint64_t i, uint8_t* row)
+            {
+                uint64_t channel = i / image.height;
+                uint64_t r = i % image.height;
+                uint8_t* dst = channel == 0 ? gray.row(0, r) :
+                    channel == 1 ? green.row(0, r) : blue.data();
+
+                if (predict)
+                    unpredict_row(row, width, image.depth, scratch.data());
+
+                if (image.depth == 8)
+                    memcpy(dst, row, width);
+                else
+                    narrow_row(row, dst, width, image.depth, r,
+                        image.depth_conversion);
+
+                if (channel == 2)
+                    Grayscale::convert_row(gray.row(0, r),
+                        green.row(0, r), blue.data(),
+                        gray.row(0, r), width);
+            }))
+            return false;
         break;
     }
     default:
         return false;
     }
 
+    // the image data is the last section, the rest of it isn't needed
+    file.pos = file.size;
+
+    image.n_channels = 1;
+    image.depth = 8;
+    if (rgb)
+        image.color_mode = PsdData::GRAYSCALE;
+
     return true;
 }
 
+// images over the PSD size limit can only be saved as PSB
+static bool is_psb(const PsdData& image)
+{
+    return image.version == PsdData::VERSION_PSB ||
+        image.width > PsdData::PSD_MAX_SIZE ||
+        image.height > PsdData::PSD_MAX_SIZE;
+}
+
 bool PsdManager::write_file_header(FILE* file, const PsdData& image)
 {
     // signature
     fputs("8BPS", file);
-    // version - 0 1, big endian
-    uint8_t one_byte_buf = 0;
     uint16_t two_byte_buf = 0;
     uint32_t four_byte_buf = 0;
-    fwrite(&one_byte_buf, 1, 1, file);
-    one_byte_buf = 1;
-    fwrite(&one_byte_buf, 1, 1, file);
+    // version - 1 for PSD, 2 for PSB, big endian
+    two_byte_buf = is_psb(image) ? PsdData::VERSION_PSB : PsdData::VERSION_PSD;
+    confirm_endianness(two_byte_buf);
+    fwrite(&two_byte_buf, 2, 1, file);
     // 6 reserved
-    one_byte_buf = 0;
-    fwrite(&one_byte_buf, 1, 6, file);
+    const uint8_t reserved[6] = {};
+    fwrite(reserved, 1, 6, file);
     // 2 byte number of channels - big endian
     two_byte_buf = image.n_channels;
     confirm_endianness(two_byte_buf);
@@ -255,98 +559,100 @@ bool PsdManager::write_image_resources(FILE* file, const PsdData&)
     return true;
 }
 
-bool PsdManager::write_layer_and_mask_info(FILE* file, const PsdData&)
+bool PsdManager::write_layer_and_mask_info(FILE* file, const PsdData& image)
 {
-    // write as empty, 4 byte length of 0
-    uint32_t zero = 0;
-    fwrite(&zero, 4, 1, file);
+    // write as empty, 4 byte length of 0, 8 bytes in PSB
+    uint64_t zero = 0;
+    fwrite(&zero, is_psb(image) ? 8 : 4, 1, file);
 
     return true;
 }
 
+// rows per parallel encoding task, each task produces one output block
+static constexpr size_t ENCODE_GRAIN = 256;
+
 bool PsdManager::write_image_data(FILE* file, const PsdData& image)
 {
     // 2 byte compression method
-    // at this point only 1 value could be used here
-    PsdData::Compression compr = PsdData::PSD_COMPR_RLE;
+    PsdData::Compression compr = image.compression;
     confirm_endianness(compr);
-    fwrite(&compr, 2, 1, file);
-
-    // 2 byte data lengths per row per channel
-    // since these need to be written before the data itself, the data
-    // should be encoded before determining its length
-    uint64_t rows_lengths_count = image.height * image.n_channels;
-    uint16_t row_len = 0;
-    // leave blank and move file pointer back after determining lengths
-    fpos_t lengths_section;
-    fgetpos(file, &lengths_section);
-
-    fwrite(&row_len, 2, rows_lengths_count, file);
-
-    // RLE encoded rows
-    uint8_t run_length = 0;
-    uint8_t color_value = 0;
-    int8_t marker = 0;
-    size_t idx = 0;
+    if (!fwrite(&compr, 2, 1, file))
+        return false;
 
-    for (auto& channel : image.channels_data)
+    switch (image.compression)
     {
-        idx = 0;
+    case PsdData::PSD_COMPR_RAW:
+        // channels one after another, no row lengths either
+        for (uint16_t ch = 0; ch < image.n_channels; ++ch)
+            for (uint32_t r = 0; r < image.height; ++r)
+                if (fwrite(image.image.row(ch, r), 1, image.width, file) !=
+                    image.width)
+                    return false;
+        return true;
+    case PsdData::PSD_COMPR_RLE:
+        break;
+    case PsdData::PSD_COMPR_ZIP_NO_PREDICT: // fallthrough
+    case PsdData::PSD_COMPR_ZIP_PREDICT:
+        return deflate_channels(file, image.image,
+            image.compression == PsdData::PSD_COMPR_ZIP_PREDICT,
+            image.zip_level);
+    default:
+        return false;
+    }
 
-        for (int r = 0, c = 0; r < image.height; ++r)
+    // 2 byte data lengths per row per channel, 4 bytes in PSB
+    // since these need to be written before the data itself, all the rows
+    // are encoded in memory first, then written with a few large writes
+    uint64_t width = image.width;
+    uint64_t height = image.height;
+    uint64_t n_rows = height * image.n_channels;
+    uint64_t max_row_len = width + (width + 127) / 128;
+    bool psb = is_psb(image);
+
+    std::vector<uint16_t> rows_lengths(psb ? 0 : n_rows);
+    std::vector<uint32_t> long_rows_lengths(psb ? n_rows : 0);
+    std::vector<std::vector<uint8_t>> blocks((n_rows + ENCODE_GRAIN - 1) /
+        ENCODE_GRAIN);
+
+    ThreadPool::global().parallel_for(0, n_rows, ENCODE_GRAIN,
+        [&](size_t from, size_t to)
         {
-            row_len = 0;
-            c = 0;
+            std::vector<uint8_t>& block = blocks[from / ENCODE_GRAIN];
+            block.resize((to - from) * max_row_len);
+            size_t block_len = 0;
 
-            while (c < image.width)
+            for (size_t i = from; i < to; ++i)
             {
-                // count amount of the same consecutive values
-                run_length = 1;
-                color_value = channel[idx++];
-                ++c;
+                const uint8_t* row = image.image.row(i / height, i % height);
 
-                while (color_value == channel[idx] && c < image.width
-                    && run_length <= 127)
-                {
-                    ++idx;
-                    ++c;
-                    ++run_length;
-                }
+                uint32_t row_len = pack_bits(row, width,
+                    block.data() + block_len);
+                block_len += row_len;
 
-                if (run_length > 1)
+                if (psb)
                 {
-                    // repeat `color_value` `run_length` times
-                    marker = 1 - run_length;
-                    fwrite(&marker, 1, 1, file);
-                    fwrite(&color_value, 1, 1, file);
-                    row_len += 2;
+                    confirm_endianness(row_len);
+                    long_rows_lengths[i] = row_len;
                 }
                 else
                 {
-                    size_t start_idx = idx - 1;
-                    // count amount of consecutive unique values
-                    while (color_value != channel[idx] && c < image.width
-                        && run_length <= 128)
-                    {
-                        color_value = channel[idx++];
-                        ++c;
-                        ++run_length;
-                    }
-                    // write `run_length` unique values
-                    marker = run_length - 1;
-                    fwrite(&marker, 1, 1, file);
-                    fwrite(&channel[start_idx], 1, run_length, file);
-                    row_len += run_length + 1;
+                    uint16_t short_row_len = row_len;
+                    confirm_endianness(short_row_len);
+                    rows_lengths[i] = short_row_len;
                 }
             }
 
-            fsetpos(file, &lengths_section);
-            confirm_endianness(row_len);
-            fwrite(&row_len, 2, 1, file);
-            fgetpos(file, &lengths_section);
-            fseek(file, 0, SEEK_END);
-        }
-    }
+            block.resize(block_len);
+        });
+
+    if (psb ? fwrite(long_rows_lengths.data(), 4, n_rows, file) != n_rows :
+        fwrite(rows_lengths.data(), 2, n_rows, file) != n_rows)
+        return false;
+
+    // RLE encoded rows
+    for (auto& block : blocks)
+        if (fwrite(block.data(), 1, block.size(), file) != block.size())
+            return false;
 
     return true;
 }
@@ -1,30 +1,35 @@
 #include "psd_manager.h"
 
-PsdData::PsdData() : image(), n_channels(image.n_channels),
-    width(image.width), height(image.height),
-    channels_data(image.channels_data)
+#include "../processing/thread_pool.h"
+
+PsdData::PsdData() : version(VERSION_PSD), compression(PSD_COMPR_RLE),
+    zip_level(-1),
+    image(), n_channels(image.n_channels),
+    width(image.width), height(image.height), depth(8),
+    depth_conversion(DEPTH_ROUND), decode_grayscale(false)
 {}
 
-bool PsdManager::open(const char* filepath)
+bool PsdManager::open(const char* filepath, OpenMode mode)
 {
-    FILE* file = fopen(filepath, "rb");
-    if (!file)
+    MappedFile file;
+    if (!file.open(filepath))
         return false;
 
     path = filepath;
+    image.decode_grayscale = mode == OPEN_GRAYSCALE;
+    ByteCursor cursor(file.data(), file.size());
 
     int section_idx = 0;
     SectionReader reader = section_readers[section_idx];
     while (reader)
     {
-        if (!reader(file, image))
+        if (!reader(cursor, image))
             break;
 
         ++section_idx;
         reader = section_readers[section_idx];
     }
 
-    fclose(file);
     if (reader) // error in one of the handlers
         return false;
     return true;
@@ -54,3 +59,55 @@ bool PsdManager::save() const
 
     return true;
 }
+
+PsdInfo PsdManager::probe(const char* filepath)
+{
+    PsdInfo info;
+
+    // mapped pages are only loaded when touched, so the pixel data is never
+    // read from the disk
+    MappedFile file;
+    if (!file.open(filepath))
+        return info;
+
+    ByteCursor cursor(file.data(), file.size());
+    PsdData header;
+
+    // same readers as `open`, except the image data one
+    for (int i = 0; section_readers[i] != read_image_data; ++i)
+        if (!section_readers[i](cursor, header))
+            return info;
+
+    // 2 byte compression method, big endian
+    uint8_t compression[2];
+    if (!cursor.read(compression, 2))
+        return info;
+
+    info.valid = true;
+    info.version = header.version;
+    info.n_channels = header.n_channels;
+    info.height = header.height;
+    info.width = header.width;
+    info.depth = header.depth;
+    info.color_mode = header.color_mode;
+    info.compression = (PsdData::Compression)(compression[0] << 8 |
+        compression[1]);
+    info.file_size = file.size();
+
+    return info;
+}
+
+std::vector<PsdInfo> PsdManager::probe(const std::vector<std::string>& paths)
+{
+    std::vector<PsdInfo> infos(paths.size());
+
+    // mostly waiting on the file system, small tasks keep all the threads busy
+    ThreadPool::global().parallel_for(0, paths.size(), 4,
+        [&](size_t from, size_t to)
+        {
+            for (size_t i = from; i < to; ++i)
+                infos[i] = probe(paths[i].c_str());
+        });
+
+    return infos;
+}
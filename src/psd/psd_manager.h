@@ -7,9 +7,12 @@
 #include <cstdint>
 #include <cstdio>
 #include <memory>
+#include <string>
 #include <vector>
 
 #include "../processing/image.h"
+#include "depth_convert.h"
+#include "mapped_file.h"
 
 // Consulted PSD specification from adobe website:
 // https://www.adobe.com/devnet-apps/photoshop/fileformatashtml/#50577409_72092
@@ -30,14 +33,26 @@ struct PsdData
         RGB = 3
     };
 
-    Compression compression;
+    enum Version : uint16_t
+    {
+        VERSION_PSD = 1,
+        VERSION_PSB         // large document format
+    };
+
+    static constexpr uint32_t PSD_MAX_SIZE = 30000;
+    static constexpr uint32_t PSB_MAX_SIZE = 300000;
+
+    Version version;            // images over 30000 px are always saved as PSB
+    Compression compression;    // read from the file, also used when saving
+    int zip_level;              // zlib level for saving ZIP, [0, 9] or -1 for default
     ImageData image;
     uint16_t& n_channels;       // [1, 24]
-    uint32_t& height;           // [1, 30000], also called "rows"
-    uint32_t& width;            // [1, 30000], also called "collumns"
-    uint16_t depth;             // bits per channel
+    uint32_t& height;           // [1, 30000], [1, 300000] in PSB, also called "rows"
+    uint32_t& width;            // [1, 30000], [1, 300000] in PSB, also called "collumns"
+    uint16_t depth;             // bits per channel, 16 and 32 become 8 when decoded
+    DepthConversion depth_conversion;   // how 16 and 32 bits get down to 8
+    bool decode_grayscale;      // only the luminance channel gets decoded, see PsdManager::open
     ColorMode color_mode;       // [0, 9], only 1 (Grayscale) and 3 (RGB) are supported
-    std::vector<std::vector<uint8_t>>& channels_data;
 
     PsdData();
 
@@ -50,17 +65,82 @@ struct PsdData
     {
         color_mode = mode;
     }
+
+    // only affects saving
+    inline void set_version(Version version)
+    {
+        this->version = version;
+    }
+
+    // takes effect on the next decode
+    inline void set_depth_conversion(DepthConversion conversion)
+    {
+        depth_conversion = conversion;
+    }
+
+    // ZIP is supported by the format, but Photoshop itself only writes it in
+    // layers data, so other applications might not open such files
+    inline void set_compression(Compression compression, int zip_level = -1)
+    {
+        this->compression = compression;
+        this->zip_level = zip_level;
+    }
+};
+
+// File metadata, read without touching the pixel data
+struct PsdInfo
+{
+    bool valid = false;         // false if the file couldn't be read or isn't supported
+    PsdData::Version version = PsdData::VERSION_PSD;
+    uint16_t n_channels = 0;
+    uint32_t height = 0;
+    uint32_t width = 0;
+    uint16_t depth = 0;         // as stored in the file
+    PsdData::ColorMode color_mode = PsdData::RGB;
+    PsdData::Compression compression = PsdData::PSD_COMPR_RLE;
+    uint64_t file_size = 0;
+
+    // memory needed to hold the decoded image, which is always 8 bits deep
+    inline uint64_t decoded_size() const
+    {
+        return (uint64_t)n_channels * height * width;
+    }
+};
+
+// JPEG thumbnail from the image resources section
+struct PsdThumbnail
+{
+    uint32_t width = 0;
+    uint32_t height = 0;
+    bool bgr = false;           // Photoshop 4.0 thumbnails have red and blue swapped
+    std::vector<uint8_t> jpeg;  // JFIF data
 };
 
 class PsdManager
 {
 public:
+    enum OpenMode
+    {
+        OPEN_ALL_CHANNELS,
+        // same result as running Grayscale right after opening, but only
+        // a single channel is ever stored. Alpha and other extra channels
+        // are skipped, images with less than 3 channels keep the first one
+        OPEN_GRAYSCALE
+    };
+
     PsdManager() = default;
     virtual ~PsdManager() = default;
 
-    bool open(const char* filepath);
+    bool open(const char* filepath, OpenMode mode = OPEN_ALL_CHANNELS);
     bool save() const;
 
+    // only reads the header and walks the section lengths up to the image data
+    static PsdInfo probe(const char* filepath);
+    // probes all the files in parallel, infos are in the same order as paths
+    static std::vector<PsdInfo> probe(const std::vector<std::string>& paths);
+    // only reads the embedded thumbnail, false if there is none
+    static bool read_thumbnail(const char* filepath, PsdThumbnail& thumbnail);
+
     inline PsdData& get_image()
     {
         return image;
@@ -80,11 +160,27 @@ private:
     PsdData image;
     std::string path;
 
-    static bool read_file_header(FILE*, PsdData&);
-    static bool read_color_mode_data(FILE*, PsdData&);
-    static bool read_image_resources(FILE*, PsdData&);
-    static bool read_layer_and_mask_info(FILE*, PsdData&);
-    static bool read_image_data(FILE*, PsdData&);
+    friend class PsdBandReader;
+
+    // readers work on the memory mapped file
+    static bool read_file_header(ByteCursor&, PsdData&);
+    static bool read_color_mode_data(ByteCursor&, PsdData&);
+    static bool read_image_resources(ByteCursor&, PsdData&);
+    static bool read_layer_and_mask_info(ByteCursor&, PsdData&);
+    static bool read_image_data(ByteCursor&, PsdData&);
+    // OPEN_GRAYSCALE part of read_image_data
+    static bool read_grayscale_data(ByteCursor&, PsdData&,
+        const std::vector<uint64_t>&);
+
+    // compression method and, for RLE, where every row of every channel starts
+    static bool read_image_data_header(ByteCursor&, PsdData&,
+        std::vector<uint64_t>&);
+    // decodes `n_rows` rows starting at `first_row` of the listed channels
+    // into the planes of an already allocated image, one plane per channel.
+    // Only for row addressable RAW and RLE data
+    static bool decode_rows(const ByteCursor&, const PsdData&,
+        const std::vector<uint64_t>&, const std::vector<uint16_t>&,
+        uint32_t, uint32_t, ImageData&);
 
     static bool write_file_header(FILE*, const PsdData&);
     static bool write_color_mode_data(FILE*, const PsdData&);
@@ -92,7 +188,7 @@ private:
     static bool write_layer_and_mask_info(FILE*, const PsdData&);
     static bool write_image_data(FILE*, const PsdData&);
 
-    typedef bool (*SectionReader)(FILE*, PsdData&);
+    typedef bool (*SectionReader)(ByteCursor&, PsdData&);
     typedef bool (*SectionWriter)(FILE*, const PsdData&);
 
     static constexpr SectionReader section_readers[] =
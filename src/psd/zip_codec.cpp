@@ -0,0 +1,198 @@
+#include "zip_codec.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <zlib.h>
+
+// zlib counts bytes in `uInt`, so big channels are fed in pieces
+static constexpr uint64_t ZLIB_CHUNK = 1u << 30;
+
+bool inflate_rows(ByteCursor& src, uint64_t row_size, uint64_t n_rows,
+    const std::function<void(uint64_t, uint8_t*)>& row_done)
+{
+    z_stream stream = {};
+    if (inflateInit(&stream) != Z_OK)
+        return false;
+
+    // a bunch of rows are inflated at once, fewer calls into zlib
+    uint64_t rows_per_chunk = std::max<uint64_t>(1, (1 << 20) / row_size);
+    std::vector<uint8_t> chunk(std::min(rows_per_chunk, n_rows) * row_size);
+
+    int status = Z_OK;
+    const uint8_t* in = src.data + src.pos;
+    uint64_t in_left = src.remaining();
+
+    for (uint64_t row = 0; row < n_rows; row += rows_per_chunk)
+    {
+        uint64_t chunk_rows = std::min(rows_per_chunk, n_rows - row);
+        uint8_t* out = chunk.data();
+        uint64_t out_left = chunk_rows * row_size;
+
+        while (out_left)
+        {
+            if (status == Z_STREAM_END)
+            {   // the stream ended before all the rows were filled
+                inflateEnd(&stream);
+                return false;
+            }
+
+            if (!stream.avail_in && in_left)
+            {
+                stream.next_in = const_cast<Bytef*>(in);
+                stream.avail_in = std::min(in_left, ZLIB_CHUNK);
+                in += stream.avail_in;
+                in_left -= stream.avail_in;
+            }
+
+            stream.next_out = out;
+            stream.avail_out = out_left;
+
+            status = inflate(&stream, Z_NO_FLUSH);
+            if (status != Z_OK && status != Z_STREAM_END)
+            {   // including Z_BUF_ERROR, the input has run out
+                inflateEnd(&stream);
+                return false;
+            }
+
+            uint64_t produced = out_left - stream.avail_out;
+            out += produced;
+            out_left -= produced;
+        }
+
+        for (uint64_t i = 0; i < chunk_rows; ++i)
+            row_done(row + i, chunk.data() + i * row_size);
+    }
+
+    // compressed data takes up the rest of the section
+    src.pos = src.size - in_left - stream.avail_in;
+    inflateEnd(&stream);
+
+    return true;
+}
+
+void unpredict_row(uint8_t* row, uint64_t width, uint16_t depth,
+    uint8_t* scratch)
+{
+    switch (depth)
+    {
+    case 8:
+        for (uint64_t c = 1; c < width; ++c)
+            row[c] += row[c - 1];
+        break;
+    case 16:
+    {
+        uint16_t prev = row[0] << 8 | row[1];
+        for (uint64_t c = 1; c < width; ++c)
+        {
+            prev += row[c * 2] << 8 | row[c * 2 + 1];
+            row[c * 2] = prev >> 8;
+            row[c * 2 + 1] = prev;
+        }
+    }
+        break;
+    case 32:
+    {
+        // deltas run over the whole row of byte planes
+        for (uint64_t c = 1; c < width * 4; ++c)
+            row[c] += row[c - 1];
+        // byte planes back to big endian values
+        memcpy(scratch, row, width * 4);
+        for (uint64_t c = 0; c < width; ++c)
+            for (int b = 0; b < 4; ++b)
+                row[c * 4 + b] = scratch[b * width + c];
+    }
+        break;
+    default:
+        break;
+    }
+}
+
+// feeds `len` bytes to the stream, writing out whatever gets compressed
+static bool deflate_bytes(FILE* file, z_stream& stream, const uint8_t* data,
+    uint64_t len, int flush, std::vector<uint8_t>& out_buf)
+{
+    do
+    {
+        uInt in_size = std::min(len, ZLIB_CHUNK);
+        stream.next_in = const_cast<Bytef*>(data);
+        stream.avail_in = in_size;
+        data += in_size;
+        len -= in_size;
+
+        int chunk_flush = len ? Z_NO_FLUSH : flush;
+        do
+        {
+            stream.next_out = out_buf.data();
+            stream.avail_out = out_buf.size();
+
+            if (deflate(&stream, chunk_flush) == Z_STREAM_ERROR)
+                return false;
+
+            size_t produced = out_buf.size() - stream.avail_out;
+            if (fwrite(out_buf.data(), 1, produced, file) != produced)
+                return false;
+        } while (!stream.avail_out);
+    } while (len);
+
+    return true;
+}
+
+bool deflate_channels(FILE* file, const ImageData& image, bool predict,
+    int level)
+{
+    uint64_t width = image.width;
+    uint64_t height = image.height;
+
+    z_stream stream = {};
+    if (deflateInit(&stream, level) != Z_OK)
+        return false;
+
+    std::vector<uint8_t> out_buf(1 << 20);
+    // delta coded or unpadded rows, a block at a time
+    constexpr uint64_t ROWS_PER_BLOCK = 64;
+    std::vector<uint8_t> block;
+
+    bool ok = true;
+    for (uint16_t ch = 0; ok && ch < image.n_channels; ++ch)
+    {
+        bool last_channel = ch + 1 == image.n_channels;
+
+        if (!predict && image.stride == width)
+        {   // no padding, the plane can go in as is
+            ok = deflate_bytes(file, stream, image.plane(ch), width * height,
+                last_channel ? Z_FINISH : Z_NO_FLUSH, out_buf);
+            continue;
+        }
+
+        for (uint64_t r = 0; ok && r < height; r += ROWS_PER_BLOCK)
+        {
+            uint64_t n_rows = std::min(ROWS_PER_BLOCK, height - r);
+            block.resize(n_rows * width);
+
+            for (uint64_t i = 0; i < n_rows; ++i)
+            {
+                const uint8_t* src = image.row(ch, r + i);
+                uint8_t* dst = block.data() + i * width;
+
+                if (!predict)
+                {
+                    memcpy(dst, src, width);
+                    continue;
+                }
+
+                dst[0] = src[0];
+                for (uint64_t c = 1; c < width; ++c)
+                    dst[c] = src[c] - src[c - 1];
+            }
+
+            bool last_block = last_channel && r + n_rows == height;
+            ok = deflate_bytes(file, stream, block.data(), block.size(),
+                last_block ? Z_FINISH : Z_NO_FLUSH, out_buf);
+        }
+    }
+
+    deflateEnd(&stream);
+
+    return ok;
+}
@@ -0,0 +1,31 @@
+#ifndef ZIP_CODEC_H
+#define ZIP_CODEC_H
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <vector>
+
+#include "../processing/image.h"
+#include "mapped_file.h"
+
+// PSD ZIP compression is a single zlib stream over all the channels, stored
+// one after another. With prediction every row is delta coded before
+// compression, each value is stored as the difference to its left neighbour
+
+// Inflates `n_rows` rows of `row_size` bytes, handing them one at a time to
+// `row_done` along with their index. The row buffer can be modified
+bool inflate_rows(ByteCursor& src, uint64_t row_size, uint64_t n_rows,
+    const std::function<void(uint64_t, uint8_t*)>& row_done);
+
+// Undoes the delta coding of a row of `width` big endian values in place.
+// 32 bit rows are also stored with the bytes of the values split into 4
+// planes, `scratch` has to fit the row for those
+void unpredict_row(uint8_t* row, uint64_t width, uint16_t depth,
+    uint8_t* scratch);
+
+// `level` is a zlib compression level, [0, 9], or -1 for zlib's default
+bool deflate_channels(FILE* file, const ImageData& image, bool predict,
+    int level);
+
+#endif // ZIP_CODEC_H
@@ -0,0 +1,119 @@
+#include <cstdio>
+#include <random>
+
+#include "processing/common_processors.h"
+
+// Compares IrregCleanup::set_all_sides(true) with setting TOP, RIGHT, BOTTOM
+// and LEFT one after the other, on byte images with and without grey pixels
+// and on BinaryImage
+
+using BorderSide = PixelView_3x3::BorderSide;
+
+static constexpr int N_IMAGES = 1500;
+static constexpr uint8_t GREY = 128;
+
+// The four sides one after the other, `repeat` rounds of them or until a
+// round changes nothing with 0. The number of rounds that changed something
+static size_t four_sides(ImageData& image, size_t repeat)
+{
+    IrregCleanup cleanup;
+    size_t rounds = 0;
+
+    while (!repeat || rounds < repeat)
+    {
+        bool processed = false;
+        for (BorderSide side : {PixelView_3x3::TOP, PixelView_3x3::RIGHT,
+            PixelView_3x3::BOTTOM, PixelView_3x3::LEFT})
+        {
+            cleanup.set_side(side);
+            processed = cleanup.process(image) || processed;
+        }
+
+        if (!processed)
+            break;
+        ++rounds;
+    }
+
+    return rounds;
+}
+
+// BLACK and WHITE noise, either uniform or in blocks of mostly one colour
+// so there are shapes with irregular borders. `grey` mixes in GREY pixels
+static void random_image(ImageData& image, std::mt19937& rng, bool grey)
+{
+    uint32_t width = rng() % 90 + 1;
+    uint32_t height = rng() % 90 + 1;
+    int density = rng() % 100;
+    bool blocks = rng() % 2;
+
+    image.allocate(1, height, width);
+    for (uint32_t r = 0; r < height; ++r)
+        for (uint32_t c = 0; c < width; ++c)
+        {
+            int d = density;
+            if (blocks)
+                d = (r / 7 + c / 5) % 2 ? 90 : 10;
+
+            uint8_t v = (int)(rng() % 100) < d ? BLACK : WHITE;
+            if (grey && rng() % 10 == 0)
+                v = GREY;
+            image.row(0, r)[c] = v;
+        }
+}
+
+int main()
+{
+    std::mt19937 rng(5);
+    IrregCleanup all;
+    all.set_all_sides(true);
+    size_t fails = 0;
+
+    for (int n = 0; n < N_IMAGES; ++n)
+    {
+        bool grey = n % 3 == 2;
+        ImageData image;
+        random_image(image, rng, grey);
+
+        for (size_t repeat : {1, 2, 3, 0})
+        {
+            ImageData expected = image;
+            size_t rounds = four_sides(expected, repeat);
+
+            all.set_repeat(repeat);
+            ImageData result = image;
+            bool processed = all.process(result);
+            if (!result.same_pixels(expected) || all.get_passes() != rounds ||
+                processed != (rounds > 0))
+            {
+                fprintf(stderr, "image %d, %ux%u%s, repeat %zu: "
+                    "%zu rounds, all sides made %zu\n", n, image.width,
+                    image.height, grey ? " with grey" : "", repeat, rounds,
+                    all.get_passes());
+                ++fails;
+            }
+
+            if (grey)
+                continue;
+
+            BinaryImage binary;
+            binary.from_image(image);
+            processed = all.process(binary);
+            binary.to_image(result);
+            if (!result.same_pixels(expected) || all.get_passes() != rounds ||
+                processed != (rounds > 0))
+            {
+                fprintf(stderr, "binary image %d, %ux%u, repeat %zu: "
+                    "%zu rounds, all sides made %zu\n", n, image.width,
+                    image.height, repeat, rounds, all.get_passes());
+                ++fails;
+            }
+        }
+    }
+
+    if (fails)
+    {
+        fprintf(stderr, "%zu cases failed\n", fails);
+        return 1;
+    }
+    return 0;
+}
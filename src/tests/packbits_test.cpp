@@ -0,0 +1,92 @@
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "psd/packbits.h"
+
+// fill byte past the end of the encode buffer, to catch writes past it
+static constexpr uint8_t GUARD = 0xa5;
+static constexpr size_t GUARD_LEN = 64;
+
+// Encodes `row` into a buffer of exactly the documented worst case size,
+// then decodes it back
+static bool check_row(const std::vector<uint8_t>& row, const std::string& name)
+{
+    size_t len = row.size();
+    size_t bound = len + (len + 127) / 128;
+    std::vector<uint8_t> packed(bound + GUARD_LEN, GUARD);
+
+    size_t packed_len = pack_bits(row.data(), len, packed.data());
+    if (packed_len > bound)
+    {
+        fprintf(stderr, "%s: %zu bytes packed into %zu, bound is %zu\n",
+            name.c_str(), len, packed_len, bound);
+        return false;
+    }
+    for (size_t i = bound; i < packed.size(); ++i)
+        if (packed[i] != GUARD)
+        {
+            fprintf(stderr, "%s: wrote past the bound\n", name.c_str());
+            return false;
+        }
+
+    std::vector<uint8_t> unpacked(len);
+    ByteCursor cursor(packed.data(), packed_len);
+    if (!unpack_bits(cursor, unpacked.data(), len) || unpacked != row ||
+        cursor.remaining())
+    {
+        fprintf(stderr, "%s: doesn't decode back\n", name.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+// row of `len` bytes repeating `pattern`, every letter a different value
+static std::vector<uint8_t> repeat(const std::string& pattern, size_t len)
+{
+    std::vector<uint8_t> row(len);
+    for (size_t i = 0; i < len; ++i)
+        row[i] = pattern[i % pattern.size()];
+    return row;
+}
+
+int main()
+{
+    // runs of 2 between single values are the worst case for the encoder,
+    // the rest are the usual edge cases around the 128 byte packet limit
+    const std::vector<std::string> patterns = {
+        "abbcdd", "abbc", "aabb", "abb", "aab", "ab", "a", "abc",
+        "aaabccc", "abbbc", "aabbbcc",
+    };
+    const std::vector<size_t> lengths = {
+        1, 2, 3, 4, 5, 127, 128, 129, 130, 255, 256, 257, 383, 384, 385,
+        900, 1000, 4096, 30001,
+    };
+
+    size_t fails = 0;
+    for (const std::string& pattern : patterns)
+        for (size_t len : lengths)
+            fails += !check_row(repeat(pattern, len),
+                "\"" + pattern + "\" x " + std::to_string(len));
+
+    // random rows over a few values, so runs of every length show up
+    std::mt19937 rng(1);
+    for (int n = 0; n < 2000; ++n)
+    {
+        size_t len = rng() % 1200 + 1;
+        unsigned values = rng() % 4 + 2;
+        std::vector<uint8_t> row(len);
+        for (uint8_t& v : row)
+            v = rng() % values;
+        fails += !check_row(row, "random " + std::to_string(n));
+    }
+
+    if (fails)
+    {
+        fprintf(stderr, "%zu rows failed\n", fails);
+        return 1;
+    }
+    return 0;
+}
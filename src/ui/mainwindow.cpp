@@ -2,6 +2,10 @@
 #include <QMessageBox>
 #include <QToolTip>
 #include <QPainter>
+#include <QScrollBar>
+
+#include <algorithm>
+#include <cmath>
 
 #include "mainwindow.h"
 
@@ -18,24 +22,39 @@ static ProcHistoryManager history_ctx;
 static LetterInfoCtx letter_info_ctx;
 
 // ===== local ImageData to Qt's QRgb struct mappers =====
-typedef QRgb (*rgb_mapper)(const ImageData& img, uint64_t idx);
+// `rows` holds the same row of every channel
+typedef QRgb (*rgb_mapper)(const uint8_t* const* rows, uint32_t c);
 
-static QRgb to_rgb(const ImageData& img, uint64_t idx)
+static QRgb to_rgb(const uint8_t* const* rows, uint32_t c)
 {
-    return qRgb(img.channels_data[0][idx], img.channels_data[1][idx],
-        img.channels_data[2][idx]);
+    return qRgb(rows[0][c], rows[1][c], rows[2][c]);
 }
 
-static QRgb to_rgba(const ImageData& img, uint64_t idx)
+static QRgb to_rgba(const uint8_t* const* rows, uint32_t c)
 {
-    return qRgba(img.channels_data[0][idx], img.channels_data[1][idx],
-        img.channels_data[2][idx], img.channels_data[3][idx]);
+    return qRgba(rows[0][c], rows[1][c], rows[2][c], rows[3][c]);
 }
 
-static QRgb to_gray(const ImageData& img, uint64_t idx)
+// single channel images go through a palette, `lut` changes the values
+// on the way if it isn't null. `q_img` gets the pixels from `x`, `y` on
+static void map_gray(const ImageData& raw_img, QImage& q_img,
+    const uint8_t* lut = nullptr, uint32_t x = 0, uint32_t y = 0)
 {
-    return qRgb(img.channels_data[0][idx], img.channels_data[0][idx],
-        img.channels_data[0][idx]);
+    QRgb palette[256];
+    for (unsigned v = 0; v < 256; ++v)
+    {
+        uint8_t value = lut ? lut[v] : v;
+        palette[v] = qRgb(value, value, value);
+    }
+
+    auto width = q_img.width();
+    for (int r = 0; r < q_img.height(); ++r)
+    {
+        const uint8_t* row = raw_img.row(0, y + r) + x;
+        QRgb *line = reinterpret_cast<QRgb*>(q_img.scanLine(r));
+        for (int c = 0; c < width; ++c)
+            line[c] = palette[row[c]];
+    }
 }
 
 static void map_image(const ImageData& raw_img, QImage& q_img)
@@ -44,8 +63,8 @@ static void map_image(const ImageData& raw_img, QImage& q_img)
     switch (raw_img.n_channels)
     {
     case 1:
-        map_pixel = to_gray;
-        break;
+        map_gray(raw_img, q_img);
+        return;
     case 3:
         map_pixel = to_rgb;
         break;
@@ -58,13 +77,17 @@ static void map_image(const ImageData& raw_img, QImage& q_img)
     }
 
     auto width = q_img.width();
+    const uint8_t* rows[4];
 
     for (int r = 0; r < q_img.height(); ++r)
     {
+        for (uint16_t ch = 0; ch < raw_img.n_channels; ++ch)
+            rows[ch] = raw_img.row(ch, r);
+
         QRgb *line = reinterpret_cast<QRgb*>(q_img.scanLine(r));
         for (int c = 0; c < width; ++c)
         {
-            line[c] = map_pixel(raw_img, r * width + c);
+            line[c] = map_pixel(rows, c);
         }
     }
 }
@@ -74,7 +97,8 @@ MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent),
     ui(new Ui::MainWindow),
     image(),
-    img_pixmap_item(img_scene.addPixmap(QPixmap::fromImage(image)))
+    img_pixmap_item(img_scene.addPixmap(QPixmap::fromImage(image))),
+    preview_item(nullptr)
 {
     ui->setupUi(this);
 
@@ -91,6 +115,10 @@ MainWindow::MainWindow(QWidget *parent)
     processors.emplace(THIN, new ThinLetters());
     processors.emplace(IRREG_CLEANUP, new IrregCleanup());
     processors.emplace(TRACE_LETTERS, new LetterFinder());
+    processors.emplace(SKELETON, new Skeletonize());
+    IrregCleanup* cleanup_all = new IrregCleanup();
+    cleanup_all->set_all_sides(true);
+    processors.emplace(IRREG_CLEANUP_ALL, cleanup_all);
 
     scale_ctx.slider = ui->slider_scale;
     scale_ctx.spinbox = ui->spinbox_scale;
@@ -115,6 +143,8 @@ MainWindow::MainWindow(QWidget *parent)
     visibility_ctx.widget_toolbox = ui->tools_tabs;
     visibility_ctx.action_save = ui->actionSave;
     visibility_ctx.action_save_as = ui->actionSave_as;
+    visibility_ctx.action_undo = ui->actionUndo;
+    visibility_ctx.action_redo = ui->actionRedo;
     visibility_ctx.no_img();
 
     duotone_visibility_ctx.widget_preview = ui->groupBox_duotone_preview;
@@ -148,6 +178,10 @@ MainWindow::MainWindow(QWidget *parent)
         this, &MainWindow::save_file);
     QObject::connect(ui->actionSave_as, &QAction::triggered,
         this, &MainWindow::save_file_as);
+    QObject::connect(ui->actionUndo, &QAction::triggered,
+        this, &MainWindow::undo);
+    QObject::connect(ui->actionRedo, &QAction::triggered,
+        this, &MainWindow::redo);
 
     // == processing events
     // grayscale
@@ -162,11 +196,26 @@ MainWindow::MainWindow(QWidget *parent)
         this, &MainWindow::duotone_cancel);
     QObject::connect(&duotone_split_ctx, &SliderSpinboxSyncCtx::value_changed,
         this, &MainWindow::duotone_try);
-    QObject::connect(&duotone_split_ctx, &SliderSpinboxSyncCtx::value_changed,
-        this, &MainWindow::duotone_try);
+    QObject::connect(ui->button_duotone_auto, &QAbstractButton::pressed,
+        this, &MainWindow::duotone_auto);
+    // the preview only covers what's in view, so it follows the view
+    auto follow_view = [this]
+    {
+        if (duotone_visibility_ctx.widget_preview->isVisible())
+            draw_duotone_preview();
+    };
+    // queued, the view gets scaled only after the value changes
+    QObject::connect(&scale_ctx, &PixmapScaleCtx::value_changed,
+        this, follow_view, Qt::QueuedConnection);
+    QObject::connect(ui->image_box->horizontalScrollBar(),
+        &QScrollBar::valueChanged, this, follow_view);
+    QObject::connect(ui->image_box->verticalScrollBar(),
+        &QScrollBar::valueChanged, this, follow_view);
     // fill holes
     QObject::connect(ui->button_fill, &QAbstractButton::pressed,
         this, &MainWindow::fill_holes);
+    QObject::connect(ui->button_skeleton, &QAbstractButton::pressed,
+        this, &MainWindow::skeletonize);
     // thin letters
     QObject::connect(ui->button_thin_top, &QAbstractButton::pressed,
         this, &MainWindow::thin_top);
@@ -176,6 +225,11 @@ MainWindow::MainWindow(QWidget *parent)
         this, &MainWindow::thin_bottom);
     QObject::connect(ui->button_thin_left, &QAbstractButton::pressed,
         this, &MainWindow::thin_left);
+    QObject::connect(ui->button_thin_all, &QAbstractButton::pressed,
+        this, &MainWindow::cleanup_all_sides);
+    // only cleaning up goes for all the sides at once
+    QObject::connect(ui->radioButton_cleanup, &QAbstractButton::toggled,
+        ui->button_thin_all, &QWidget::setEnabled);
     // trace letters
     QObject::connect(ui->button_trace_letters, &QAbstractButton::pressed,
         this, &MainWindow::trace_letters);
@@ -185,10 +239,15 @@ MainWindow::MainWindow(QWidget *parent)
         this, &MainWindow::import_history);
     QObject::connect(ui->button_export_history, &QAbstractButton::pressed,
         this, &MainWindow::export_history);
+    QObject::connect(ui->listView, &QAbstractItemView::doubleClicked,
+        this, &MainWindow::history_jump);
 }
 
 MainWindow::~MainWindow()
 {
+    if (loader.joinable())
+        loader.join();
+
     delete history_str_model;
     delete ui;
 }
@@ -204,6 +263,7 @@ void MainWindow::draw_image(const ImageData& raw_img)
     map_image(raw_img, image);
 
     img_scene.clear();
+    preview_item = nullptr;
     img_pixmap_item = img_scene.addPixmap(QPixmap::fromImage(image));
     img_pixmap_item->setTransformOriginPoint(img_scene.sceneRect().center());
 
@@ -236,13 +296,42 @@ void MainWindow::draw_image()
     draw_image(psd_manager.get_image().get_raw());
 }
 
+void MainWindow::draw_thumbnail(const PsdThumbnail& thumbnail,
+    const PsdInfo& info)
+{
+    QImage preview;
+    if (!preview.loadFromData(thumbnail.jpeg.data(), thumbnail.jpeg.size(),
+        "JPG"))
+        return;
+    if (thumbnail.bgr)
+        preview = preview.rgbSwapped();
+
+    clear_letter_meta();
+    img_scene.clear();
+    preview_item = nullptr;
+    img_pixmap_item = img_scene.addPixmap(QPixmap::fromImage(preview));
+    // stretched over the full image size, so the view doesn't jump
+    // once the real image replaces it
+    img_pixmap_item->setTransform(QTransform::fromScale(
+        (double)info.width / preview.width(),
+        (double)info.height / preview.height()));
+
+    ui->image_box->setScene(&img_scene);
+    ui->image_box->repaint();
+}
+
 void MainWindow::open_file()
 {
     QString file_name = QFileDialog::getOpenFileName(this,
-        tr("Open PSD Image"), "", tr("PSD File (*.psd)"));
+        tr("Open PSD Image"), "", tr("PSD File (*.psd *.psb)"));
     if (file_name.isEmpty())
         return;
-    if (!psd_manager.open(file_name.toLocal8Bit().data()))
+
+    std::string path = file_name.toLocal8Bit().data();
+
+    // unsupported files are rejected before the current image is dropped
+    PsdInfo info = PsdManager::probe(path.c_str());
+    if (!info.valid)
     {
         // NOTE: could display error specific info if PsdManager was to provide it
         QMessageBox::warning(this, tr("Error opening file"),
@@ -250,8 +339,56 @@ void MainWindow::open_file()
             QMessageBox::Ok);
         return;
     }
+
+    // the embedded thumbnail is shown while the whole image is decoded
+    PsdThumbnail thumbnail;
+    if (PsdManager::read_thumbnail(path.c_str(), thumbnail))
+        draw_thumbnail(thumbnail, info);
+
+    visibility_ctx.no_img();
+    ui->actionOpen->setEnabled(false);
+
+    if (loader.joinable())
+        loader.join();
+
+    loader = std::thread([this, path]
+        {
+            bool opened = psd_manager.open(path.c_str());
+            if (opened)
+                pyramid.build(psd_manager.get_image().get_raw());
+            else
+                pyramid.clear();
+
+            QMetaObject::invokeMethod(this, [this, opened]
+                {
+                    file_opened(opened);
+                }, Qt::QueuedConnection);
+        });
+}
+
+void MainWindow::file_opened(bool opened)
+{
+    loader.join();
+    ui->actionOpen->setEnabled(true);
+
+    // the previous image is gone either way, its history and snapshots go
+    // with it
     proc_history.clear();
+    redo_steps.clear();
+    snapshots.clear();
     history_ctx.clear();
+
+    if (!opened)
+    {
+        clear_letter_meta();
+        img_scene.clear();
+        preview_item = nullptr;
+        QMessageBox::warning(this, tr("Error opening file"),
+            tr("An error occured while opening selected file."),
+            QMessageBox::Ok);
+        return;
+    }
+
     clear_letter_meta();
     draw_image();
 
@@ -267,11 +404,34 @@ void MainWindow::save_file()
 
 void MainWindow::save_file_as()
 {
+    // filters double as the compression choice
+    const QString filter_rle = tr("PSD File, RLE (*.psd *.psb)");
+    const QString filter_raw = tr("PSD File, uncompressed (*.psd *.psb)");
+    const QString filter_zip = tr("PSD File, ZIP (*.psd *.psb)");
+    const QString filter_zip_fast = tr("PSD File, fast ZIP (*.psd *.psb)");
+
+    QString selected_filter = filter_rle;
     QString file_name = QFileDialog::getSaveFileName(this,
-        tr("Open PSD Image"), "", tr("PSD File (*.psd)"));
+        tr("Open PSD Image"), "",
+        filter_rle + ";;" + filter_raw + ";;" + filter_zip + ";;" +
+        filter_zip_fast, &selected_filter);
     if (file_name.isEmpty())
         return;
 
+    PsdData& img = psd_manager.get_image();
+    if (selected_filter == filter_raw)
+        img.set_compression(PsdData::PSD_COMPR_RAW);
+    else if (selected_filter == filter_zip)
+        img.set_compression(PsdData::PSD_COMPR_ZIP_PREDICT);
+    else if (selected_filter == filter_zip_fast)
+        img.set_compression(PsdData::PSD_COMPR_ZIP_PREDICT, 1);
+    else
+        img.set_compression(PsdData::PSD_COMPR_RLE);
+
+    // images that are too large for PSD are saved as PSB regardless
+    img.set_version(file_name.endsWith(".psb", Qt::CaseInsensitive) ?
+        PsdData::VERSION_PSB : PsdData::VERSION_PSD);
+
     psd_manager.set_save_path(file_name.toLocal8Bit().data());
 
     visibility_ctx.img_saved();
@@ -288,6 +448,7 @@ void MainWindow::grayscale()
     if (processors[GRAYSCALE]->process(img.get_raw()))
     {
         img.set_color_mode(PsdData::ColorMode::GRAYSCALE);
+        pyramid.build(img.get_raw());
         draw_image();
     }
 }
@@ -303,47 +464,107 @@ void MainWindow::duotone_start()
         return;
     }
 
+    // the only pass over the image until the result is accepted, the
+    // preview itself only reads what's on screen
+    ((Duotone*)processors[DUOTONE].get())->init_preview(
+        psd_manager.get_image().get_raw());
+    if (pyramid.empty())
+        pyramid.build(psd_manager.get_image().get_raw());
+
     duotone_visibility_ctx.start_preview();
     duotone_try(duotone_split_ctx.get_last());
 }
 
+// the image itself isn't touched, it's drawn through the threshold
 void MainWindow::duotone_try(int value)
 {
     Duotone* duotone = (Duotone*)processors[DUOTONE].get();
+    const ImageData& raw = psd_manager.get_image().get_raw();
 
     duotone->set_split_value(value);
-    if (duotone->process(psd_manager.get_image().get_raw()))
-        draw_image(duotone->get_preview());
+    draw_duotone_preview();
+
+    uint64_t total = (uint64_t)raw.width * raw.height;
+    double black = total ? 100.0 * duotone->black_count(value) / total : 0;
+    ui->label_duotone_black->setText(
+        QString("Black: %1%").arg(black, 0, 'f', 1));
 }
 
-void MainWindow::duotone_done()
+void MainWindow::duotone_auto()
 {
-    duotone_visibility_ctx.end_preview();
-
     Duotone* duotone = (Duotone*)processors[DUOTONE].get();
-    psd_manager.get_image().get_raw() = duotone->get_preview();
-    duotone->clear_preview();
+    duotone_split_ctx.sync(duotone->otsu_split());
+}
 
-    draw_image();
+// Only the part of the image in the view is thresholded, from the pyramid
+// level matching the zoom, and drawn over the image. The image under it
+// stays as it is, cancelling only has to remove it
+void MainWindow::draw_duotone_preview()
+{
+    if (pyramid.empty())
+        return;
 
-    unsigned split_value = duotone->get_split_value();
+    QGraphicsView* view = ui->image_box;
+    const ImageData& raw = psd_manager.get_image().get_raw();
+    QRectF visible = view->mapToScene(view->viewport()->rect())
+        .boundingRect().intersected(QRectF(0, 0, raw.width, raw.height));
+
+    size_t i = pyramid.level_for(view->transform().m11());
+    const ImageData& level = pyramid.level(i);
+    double factor = 1 << i;
+
+    uint32_t x0 = std::floor(visible.left() / factor);
+    uint32_t y0 = std::floor(visible.top() / factor);
+    uint32_t x1 = std::min<double>(std::ceil(visible.right() / factor),
+        level.width);
+    uint32_t y1 = std::min<double>(std::ceil(visible.bottom() / factor),
+        level.height);
+    if (visible.isEmpty() || x0 >= x1 || y0 >= y1)
+        return;
 
-    if (!proc_history.size() || proc_history.back()->type != DUOTONE ||
-        ((ThresholdActionCtx*)proc_history.back().get())->threshold != split_value)
-        proc_history.emplace_back(new ThresholdActionCtx(DUOTONE,
-            split_value));
+    uint8_t lut[256];
+    ((Duotone*)processors[DUOTONE].get())->get_lut(lut);
 
-    ++proc_history.back()->count;
+    QImage preview(x1 - x0, y1 - y0, QImage::Format_ARGB32);
+    map_gray(level, preview, lut, x0, y0);
 
-    history_ctx.add(*proc_history.back().get());
+    if (!preview_item)
+        preview_item = img_scene.addPixmap(QPixmap());
+    preview_item->setPixmap(QPixmap::fromImage(preview));
+    preview_item->setPos(x0 * factor, y0 * factor);
+    preview_item->setScale(factor);
 }
 
-void MainWindow::duotone_cancel()
+void MainWindow::clear_duotone_preview()
+{
+    if (preview_item)
+    {
+        img_scene.removeItem(preview_item);
+        delete preview_item;
+        preview_item = nullptr;
+    }
+    ((Duotone*)processors[DUOTONE].get())->clear_preview();
+}
+
+void MainWindow::duotone_done()
 {
     duotone_visibility_ctx.end_preview();
+    clear_duotone_preview();
+
+    // the full resolution image is only processed now
+    Duotone* duotone = (Duotone*)processors[DUOTONE].get();
+    begin_step();
+    duotone->process(psd_manager.get_image().get_raw());
 
-    ((Duotone*)processors[DUOTONE].get())->clear_preview();
     draw_image();
+
+    add_step(new ThresholdActionCtx(DUOTONE, duotone->get_split_value()));
+}
+
+void MainWindow::duotone_cancel()
+{
+    duotone_visibility_ctx.end_preview();
+    clear_duotone_preview();
 }
 
 void MainWindow::fill_holes()
@@ -362,16 +583,38 @@ void MainWindow::fill_holes()
     Fill* fill = (Fill*)processors[FILL].get();
 
     fill->set_color(0);
+    fill->set_repeat(ui->checkBox_until_stable->isChecked() ? 0 : 1);
+    begin_step();
     if (!fill->process(img.get_raw()))
         return;
 
     draw_image();
 
-    if (!proc_history.size() || proc_history.back()->type != FILL)
-        proc_history.emplace_back(new ProcCtx(FILL));
-    ++proc_history.back()->count;
+    // every pass is recorded, as if it was done by hand
+    add_step(new ProcCtx(FILL), fill->get_passes());
+}
+
+void MainWindow::skeletonize()
+{
+    PsdData& img = psd_manager.get_image();
 
-    history_ctx.add(*proc_history.back().get());
+    if (img.n_channels != 1)
+    {
+        QToolTip::showText(
+            ui->button_skeleton->mapToGlobal(QPoint(0, 0)),
+            "A duotone 1 channel image is expected for this action",
+            ui->button_skeleton);
+        return;
+    }
+
+    // thins all the way in a single step
+    begin_step();
+    if (!processors[SKELETON]->process(img.get_raw()))
+        return;
+
+    draw_image();
+
+    add_step(new ProcCtx(SKELETON));
 }
 
 void MainWindow::thin_letter(BorderSide side)
@@ -393,17 +636,14 @@ void MainWindow::thin_letter(BorderSide side)
     DirectionalPrcessor* proc = (DirectionalPrcessor*)processors[type].get();
 
     proc->set_side(side);
+    proc->set_repeat(ui->checkBox_until_stable->isChecked() ? 0 : 1);
+    begin_step();
     if (!proc->process(img.get_raw()))
         return;
 
     draw_image();
 
-    if (!proc_history.size() || proc_history.back()->type != type ||
-        ((DirectionalActionCtx*)proc_history.back().get())->side != side)
-        proc_history.emplace_back(new DirectionalActionCtx(type, side));
-    ++proc_history.back()->count;
-
-    history_ctx.add(*proc_history.back().get());
+    add_step(new DirectionalActionCtx(type, side), proc->get_passes());
 }
 
 void MainWindow::thin_top()
@@ -426,6 +666,31 @@ void MainWindow::thin_left()
     thin_letter(BorderSide::LEFT);
 }
 
+void MainWindow::cleanup_all_sides()
+{
+    PsdData& img = psd_manager.get_image();
+
+    if (img.n_channels != 1)
+    {
+        QToolTip::showText(
+            ui->button_fill->mapToGlobal(QPoint(0, 0)),
+            "A duotone 1 channel image is expected for this action",
+            ui->button_fill);
+        return;
+    }
+
+    IrregCleanup* proc = (IrregCleanup*)processors[IRREG_CLEANUP_ALL].get();
+
+    proc->set_repeat(ui->checkBox_until_stable->isChecked() ? 0 : 1);
+    begin_step();
+    if (!proc->process(img.get_raw()))
+        return;
+
+    draw_image();
+
+    add_step(new ProcCtx(IRREG_CLEANUP_ALL), proc->get_passes());
+}
+
 void MainWindow::trace_letters()
 {
     PsdData& img = psd_manager.get_image();
@@ -444,17 +709,26 @@ void MainWindow::trace_letters()
     size_t last_size = 0;
     auto& letters = proc->get_letters();
 
-    while (proc->process(img.get_raw()))
+    BinaryImage binary;
+    if (binary.from_image(img.get_raw()))
+    {   // duotone images are traced bit-packed, a letter per call
+        while (proc->process(binary))
+            add_letter_meta(proc->last_letter());
+    }
+    else
     {
-        proc->process(img.get_raw());
+        while (proc->process(img.get_raw()))
+        {
+            proc->process(img.get_raw());
 
-        if (last_size == letters.size())
-            continue;
+            if (last_size == letters.size())
+                continue;
 
-        last_size = letters.size();
-        const LetterData& l = proc->last_letter();
+            last_size = letters.size();
+            const LetterData& l = proc->last_letter();
 
-        add_letter_meta(l);
+            add_letter_meta(l);
+        }
     }
 
     proc->clear();
@@ -498,6 +772,8 @@ void MainWindow::import_history()
     }
 
     proc_history.clear();
+    redo_steps.clear();
+    snapshots.clear();
     history_ctx.clear();
 
     for (unsigned i = 0; i < size; ++i)
@@ -509,7 +785,9 @@ void MainWindow::import_history()
         case DUOTONE:
             proc_history.emplace_back(new ThresholdActionCtx(ctx.type, file));
             break;
-        case FILL:
+        case FILL: // fallthrough
+        case SKELETON: // fallthrough
+        case IRREG_CLEANUP_ALL:
             proc_history.emplace_back(new ProcCtx(ctx.type));
             break;
         case THIN: // fallthrough
@@ -525,10 +803,10 @@ void MainWindow::import_history()
         }
 
         proc_history.back()->count = ctx.count;
-        history_ctx.add(*proc_history.back().get());
     }
 
     fclose(file);
+    history_ctx.set(proc_history);
 
     reapply_history();
 }
@@ -558,26 +836,172 @@ void MainWindow::export_history()
     fclose(file);
 }
 
-void MainWindow::reapply_history()
+size_t MainWindow::history_steps() const
 {
-    // TODO: would be way easier, if processing actions implemented
-    // "command" pattern
+    size_t steps = 0;
+    for (auto& act : proc_history)
+        steps += act->count;
+
+    return steps;
+}
+
+// called before a step changes the image, the image before any step is
+// the first snapshot
+void MainWindow::begin_step()
+{
+    pyramid.clear();
+    if (!history_steps() && !snapshots.has(0))
+        snapshots.record(0, psd_manager.get_image().get_raw());
+}
+
+void MainWindow::add_step(ProcCtx* step, size_t times)
+{
+    bool merged = proc_history.size() &&
+        proc_history.back()->same_action(*step);
+    if (!merged)
+        proc_history.emplace_back(step);
+    else
+        delete step;
+
+    proc_history.back()->count += times;
+    history_ctx.add(*proc_history.back().get(), merged);
+
+    // a new step replaces whatever was undone
+    redo_steps.clear();
+    snapshots.record(history_steps(), psd_manager.get_image().get_raw());
+}
+
+// `proc_history` has to already be at `step`
+void MainWindow::restore_step(size_t step)
+{
+    ImageData& raw = psd_manager.get_image().get_raw();
+    size_t restored = 0;
+    pyramid.clear();
+
+    if (!snapshots.restore(step, raw, restored))
+    {
+        // every snapshot up to it has been dropped
+        if (!reopen_image())
+            return;
+        restored = 0;
+    }
 
-    // reopen image to reset current processing
-    if (!psd_manager.open(psd_manager.get_path()))
+    if (restored < step)
+    {
+        replay_history(restored);
+        snapshots.invalidate();
+    }
+
+    clear_letter_meta();
+    draw_image();
+}
+
+void MainWindow::undo()
+{
+    if (!proc_history.size())
+        return;
+
+    if (duotone_visibility_ctx.widget_preview->isVisible())
+        duotone_cancel();
+
+    ProcCtx* step = proc_history.back()->clone();
+    step->count = 1;
+    redo_steps.emplace_back(step);
+
+    if (!--proc_history.back()->count)
+        proc_history.pop_back();
+    history_ctx.set(proc_history);
+
+    restore_step(history_steps());
+}
+
+void MainWindow::redo()
+{
+    if (!redo_steps.size())
+        return;
+
+    if (duotone_visibility_ctx.widget_preview->isVisible())
+        duotone_cancel();
+
+    ProcCtx* step = redo_steps.back().release();
+    redo_steps.pop_back();
+
+    step->count = 0;
+    if (!proc_history.size() || !proc_history.back()->same_action(*step))
+        proc_history.emplace_back(step);
+    else
+        delete step;
+    ++proc_history.back()->count;
+    history_ctx.set(proc_history);
+
+    restore_step(history_steps());
+}
+
+// goes back to right after the double clicked history entry
+void MainWindow::history_jump(const QModelIndex& index)
+{
+    if (!index.isValid() || index.row() + 1 >= (int)proc_history.size())
+        return;
+
+    if (duotone_visibility_ctx.widget_preview->isVisible())
+        duotone_cancel();
+
+    while (proc_history.size() > (size_t)index.row() + 1)
+    {
+        ProcCtx* step = proc_history.back()->clone();
+        step->count = 1;
+        for (size_t i = 0; i < proc_history.back()->count; ++i)
+            redo_steps.emplace_back(step->clone());
+        delete step;
+
+        proc_history.pop_back();
+    }
+    history_ctx.set(proc_history);
+
+    restore_step(history_steps());
+}
+
+// reopen image to reset current processing, history always starts
+// with a grayscaled image, so it's decoded straight to one channel
+bool MainWindow::reopen_image()
+{
+    if (!psd_manager.open(psd_manager.get_path(), PsdManager::OPEN_GRAYSCALE))
     {
         QMessageBox::warning(this, tr("Error opening file"),
             tr("An error occured while reopening image file."),
             QMessageBox::Ok);
-        return;
+        return false;
     }
     clear_letter_meta();
+    snapshots.invalidate();
+    pyramid.clear();
+
+    return true;
+}
+
+// applies the history to the image, skipping the steps before `first_step`
+bool MainWindow::replay_history(size_t first_step)
+{
+    // TODO: would be way easier, if processing actions implemented
+    // "command" pattern
 
-    if (psd_manager.get_image().n_channels > 1)
-        processors[GRAYSCALE]->process(psd_manager.get_image().get_raw());
+    // after Duotone the image is only BLACK and WHITE, the following steps
+    // run on a bit-packed copy of it until the next Duotone
+    ImageData& raw = psd_manager.get_image().get_raw();
+    BinaryImage binary;
+    bool is_binary = first_step && binary.from_image(raw);
+    size_t step = 0;
 
     for (auto& act : proc_history)
     {
+        // repetitions of the entry that are left to apply, the repeatable
+        // processors run them all in a single call
+        size_t skipped = std::min(act->count,
+            first_step - std::min(first_step, step));
+        size_t times = act->count - skipped;
+        step += act->count;
+        if (!times)
+            continue;
 
         switch (act->type)
         {
@@ -587,10 +1011,13 @@ void MainWindow::reapply_history()
             auto ctx = (ThresholdActionCtx*)act.get();
             duotone->set_split_value(ctx->threshold);
 
-            duotone->process(psd_manager.get_image().get_raw());
+            if (is_binary)
+                binary.to_image(raw);
 
-            psd_manager.get_image().get_raw() = duotone->get_preview();
-            duotone->clear_preview();
+            // thresholding again changes nothing
+            duotone->process(raw);
+
+            is_binary = binary.from_image(raw);
         }
             break;
         case FILL:
@@ -598,9 +1025,22 @@ void MainWindow::reapply_history()
             Fill* fill = (Fill*)processors[FILL].get();
 
             fill->set_color(0);
-            fill->process(psd_manager.get_image().get_raw());
+            fill->set_repeat(times);
+            if (is_binary)
+                fill->process(binary);
+            else
+                fill->process(raw);
         }
             break;
+        case SKELETON:
+            // works on bytes only, and goes until nothing changes already
+            if (is_binary)
+                binary.to_image(raw);
+
+            processors[SKELETON]->process(raw);
+
+            is_binary = binary.from_image(raw);
+            break;
         case THIN: // fallthrough
         case IRREG_CLEANUP:
         {
@@ -608,18 +1048,52 @@ void MainWindow::reapply_history()
             auto proc = (DirectionalPrcessor*)processors[ctx->type].get();
 
             proc->set_side(ctx->side);
-            proc->process(psd_manager.get_image().get_raw());
+            proc->set_repeat(times);
+            if (is_binary)
+                proc->process(binary);
+            else
+                proc->process(raw);
+        }
+            break;
+        case IRREG_CLEANUP_ALL:
+        {
+            auto proc = (IrregCleanup*)processors[IRREG_CLEANUP_ALL].get();
+
+            proc->set_repeat(times);
+            if (is_binary)
+                proc->process(binary);
+            else
+                proc->process(raw);
         }
             break;
         default:
+            if (is_binary)
+                binary.to_image(raw);
+
             QMessageBox::warning(this, tr("Error applying history"),
                 tr("An error occured while applying history from the file."),
                 QMessageBox::Ok);
             // TODO: what should happen here?
-            return;
+            return false;
         }
     }
 
+    if (is_binary)
+        binary.to_image(raw);
+
+    return true;
+}
+
+void MainWindow::reapply_history()
+{
+    if (!reopen_image())
+        return;
+
+    snapshots.clear();
+    snapshots.record(0, psd_manager.get_image().get_raw());
+    if (replay_history(0))
+        snapshots.record(history_steps(), psd_manager.get_image().get_raw());
+
     draw_image();
 }
 
@@ -655,6 +1129,9 @@ namespace ui_context {
         case FILL:
             ss << "Fill holes";
             break;
+        case SKELETON:
+            ss << "Skeleton";
+            break;
         case THIN:
             ss << "Thin, ";
             side_to_str(((DirectionalActionCtx*)ctx)->side, ss);
@@ -663,29 +1140,51 @@ namespace ui_context {
             ss << "Cleanup, ";
             side_to_str(((DirectionalActionCtx*)ctx)->side, ss);
             break;
+        case IRREG_CLEANUP_ALL:
+            ss << "Cleanup, all sides";
+            break;
         default:
             break;
         }
     }
 }
 
-void ProcHistoryManager::add(const ProcCtx& ctx)
+static void entry_to_str(const ProcCtx& ctx, std::stringstream& ss)
 {
-    std::stringstream ss;
-
     proc_to_str(&ctx, ss);
 
     if (ctx.count > 1)
-    {
         ss << ", " << ctx.count << " times";
-        if (list->size())
-            list->removeLast();
-    }
+}
+
+void ProcHistoryManager::add(const ProcCtx& ctx, bool merged)
+{
+    std::stringstream ss;
+
+    entry_to_str(ctx, ss);
+
+    if (merged && list->size())
+        list->removeLast();
 
     list->append(ss.str().c_str());
     model->setStringList(*list);
 }
 
+void ProcHistoryManager::set(
+    const std::list<std::unique_ptr<ProcCtx>>& history)
+{
+    list->clear();
+
+    for (auto& ctx : history)
+    {
+        std::stringstream ss;
+        entry_to_str(*ctx, ss);
+        list->append(ss.str().c_str());
+    }
+
+    model->setStringList(*list);
+}
+
 void ProcHistoryManager::clear()
 {
     list->clear();
@@ -7,9 +7,13 @@
 #include <QStringListModel>
 #include <QGraphicsSceneMouseEvent>
 
+#include <thread>
+
 #include "../psd/psd_manager.h"
 #include "../processing/processor_api.h"
 #include "../processing/common_processors.h"
+#include "../processing/image_snapshot.h"
+#include "../processing/image_pyramid.h"
 
 #include "proc_ctx.h"
 
@@ -52,40 +56,72 @@ public slots:
     void grayscale();
     void duotone_start();
     void duotone_try(int);
+    // Otsu's split value
+    void duotone_auto();
     void duotone_done();
     void duotone_cancel();
     void fill_holes();
+    void skeletonize();
     void thin_top();
     void thin_right();
     void thin_bottom();
     void thin_left();
+    void cleanup_all_sides();
     void trace_letters();
 
     void import_history();
     void export_history();
 
+    void undo();
+    void redo();
+    void history_jump(const QModelIndex&);
+
 private:
     Ui::MainWindow *ui;
 
     QImage image;
     QGraphicsScene img_scene;
     QGraphicsPixmapItem* img_pixmap_item;
+    // the Duotone preview of the part of the image in view, over the image
+    QGraphicsPixmapItem* preview_item;
     QStringListModel* history_str_model;
     QStringList history_strs;
 
     PsdManager psd_manager;
+    // decodes the opened file in the background, psd_manager isn't touched
+    // by the UI while it runs
+    std::thread loader;
 
     std::map<ProcessorType, std::unique_ptr<ImageProcessor>> processors;
     std::list<std::unique_ptr<ProcCtx>> proc_history;
+    // undone steps, a single application each, the last one is redone first
+    std::vector<std::unique_ptr<ProcCtx>> redo_steps;
+    // the image after every step of the history
+    SnapshotHistory snapshots;
+    // smaller copies of the current image for the Duotone preview, cleared
+    // whenever the image changes
+    ImagePyramid pyramid;
     std::vector<LetterRect*> letters_meta;
 
     void draw_image();
     void draw_image(const ImageData&);
+    void draw_duotone_preview();
+    void clear_duotone_preview();
+    void draw_thumbnail(const PsdThumbnail&, const PsdInfo&);
+    void file_opened(bool);
     void add_letter_meta(const class LetterData& letter);
     void clear_letter_meta();
 
     void thin_letter(BorderSide);
 
+    // steps of the history, repeated ones counted every time
+    size_t history_steps() const;
+    void begin_step();
+    // records the step just applied to the image, `times` times over
+    void add_step(ProcCtx*, size_t times = 1);
+    void restore_step(size_t);
+    bool reopen_image();
+    bool replay_history(size_t first_step);
     void reapply_history();
 };
 #endif // MAIN_WINDOW_H
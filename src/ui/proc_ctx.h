@@ -14,10 +14,12 @@ enum ProcessorType
     FILL,
     THIN,
     IRREG_CLEANUP,
-    TRACE_LETTERS
+    TRACE_LETTERS,
+    SKELETON,
+    IRREG_CLEANUP_ALL
 };
 
-// Used for FILL
+// Used for FILL, SKELETON, IRREG_CLEANUP_ALL
 struct ProcCtx
 {
     size_t count;
@@ -28,6 +30,16 @@ struct ProcCtx
     {}
     virtual ~ProcCtx() = default;
 
+    virtual ProcCtx* clone() const
+    {
+        return new ProcCtx(*this);
+    }
+    // the same action with the same settings, `count` aside
+    virtual bool same_action(const ProcCtx& other) const
+    {
+        return type == other.type;
+    }
+
     // Inherited classes should call parent's serialize method
     virtual void serialize(FILE*) const;
     // Inherited classes shouldn't call parent's deserialize method,
@@ -53,6 +65,17 @@ struct DirectionalActionCtx : public ProcCtx
         deserialize(file);
     }
 
+    ProcCtx* clone() const override
+    {
+        return new DirectionalActionCtx(*this);
+    }
+
+    bool same_action(const ProcCtx& other) const override
+    {
+        return type == other.type &&
+            side == ((const DirectionalActionCtx&)other).side;
+    }
+
     void serialize(FILE*) const override;
     bool deserialize(FILE*);
 };
@@ -72,6 +95,17 @@ struct ThresholdActionCtx : public ProcCtx
         deserialize(file);
     }
 
+    ProcCtx* clone() const override
+    {
+        return new ThresholdActionCtx(*this);
+    }
+
+    bool same_action(const ProcCtx& other) const override
+    {
+        return type == other.type &&
+            threshold == ((const ThresholdActionCtx&)other).threshold;
+    }
+
     void serialize(FILE*) const override;
     bool deserialize(FILE*);
 };
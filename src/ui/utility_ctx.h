@@ -8,6 +8,9 @@
 #include "qspinbox.h"
 #include "qstringlistmodel.h"
 
+#include <list>
+#include <memory>
+
 #include "../psd/psd_manager.h"
 
 #include "proc_ctx.h"
@@ -114,6 +117,9 @@ struct
     QWidget* widget_toolbox;
     QAction* action_save_as;
     QAction* action_save;
+    // the image can't be touched while another one is being opened
+    QAction* action_undo;
+    QAction* action_redo;
 
     inline void no_img()
     {
@@ -121,6 +127,8 @@ struct
         widget_toolbox->setVisible(false);
         action_save_as->setEnabled(false);
         action_save->setEnabled(false);
+        action_undo->setEnabled(false);
+        action_redo->setEnabled(false);
     }
 
     inline void img_opened()
@@ -129,6 +137,8 @@ struct
         widget_toolbox->setVisible(true);
         action_save_as->setEnabled(true);
         action_save->setEnabled(false);
+        action_undo->setEnabled(true);
+        action_redo->setEnabled(true);
     }
 
     inline void img_saved()
@@ -137,6 +147,8 @@ struct
         widget_toolbox->setVisible(true);
         action_save_as->setEnabled(true);
         action_save->setEnabled(true);
+        action_undo->setEnabled(true);
+        action_redo->setEnabled(true);
     }
 } visibility_ctx;
 
@@ -179,7 +191,10 @@ struct ProcHistoryManager
     QStringListModel* model;
     QStringList* list;
 
-    void add(const ProcCtx&);
+    // `merged` replaces the last entry, `ctx` has been added to it
+    void add(const ProcCtx&, bool merged);
+    // the whole list over again
+    void set(const std::list<std::unique_ptr<ProcCtx>>&);
     void clear();
 };
 